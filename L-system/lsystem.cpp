@@ -2,15 +2,85 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include <array>
 #include <stack>
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <charconv>
+#include <atomic>
+#include <new>
+#include <omp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef LSYSTEM_ZLIB
+#include <zlib.h>
+static constexpr bool haveZlib = true;
+#else
+static constexpr bool haveZlib = false;
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+// Build with -DLSYSTEM_ALLOC_COUNT to count every operator new for the
+// --profile report: two relaxed atomic adds per allocation, so it is left
+// out of normal builds and the report shows allocations as unavailable.
+struct AllocCounter {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> count{0};
+};
+static AllocCounter allocCounter;
+
+#ifdef LSYSTEM_ALLOC_COUNT
+static constexpr bool countingAllocations = true;
+// Not inlined, so GCC doesn't pair the malloc/free inside with new/delete
+// at call sites.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    allocCounter.bytes.fetch_add(size, std::memory_order_relaxed);
+    allocCounter.count.fetch_add(1, std::memory_order_relaxed);
+    if(void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { operator delete(p); }
+#else
+static constexpr bool countingAllocations = false;
+#endif
+
+// Progress messages of the expansion, interpretation and render steps go to
+// std::cout, or to the stream a ProgressTo set on the current thread, so
+// concurrent --batch jobs can print theirs in one piece.
+inline std::ostream*& progressTarget() {
+    static thread_local std::ostream* target = nullptr;
+    return target;
+}
+
+inline std::ostream& progress() { return progressTarget() ? *progressTarget() : std::cout; }
+
+class ProgressTo {
+private:
+    std::ostream* previous;
+    
+public:
+    explicit ProgressTo(std::ostream& out) : previous(progressTarget()) { progressTarget() = &out; }
+    ~ProgressTo() { progressTarget() = previous; }
+};
+
 struct Vec3 {
     float x, y, z;
     
@@ -130,18 +200,230 @@ public:
         for(int gen = 0; gen < generations; gen++) {
             std::string next;
             for(char c : current) {
-                if(rules.find(c) != rules.end()) {
-                    next += rules[c];
+                auto rule = rules.find(c);
+                if(rule != rules.end()) {
+                    next += rule->second;
                 } else {
                     next += c;
                 }
             }
             current = next;
-            std::cout << "Generation " << gen + 1 << ": Length = " << current.length() << std::endl;
+            progress() << "Generation " << gen + 1 << ": Length = " << current.length() << std::endl;
+        }
+    }
+    
+    // Exact expansion lengths without expanding: lengths[g][c] is how many
+    // symbols c turns into after g generations. Saturates at UINT64_MAX.
+    std::vector<std::vector<uint64_t>> expansionLengths(int generations) const {
+        std::vector<std::vector<uint64_t>> lengths(generations + 1, std::vector<uint64_t>(256, 1));
+        for(int gen = 1; gen <= generations; gen++) {
+            for(const auto& rule : rules) {
+                uint64_t total = 0;
+                for(char c : rule.second) {
+                    uint64_t len = lengths[gen - 1][(unsigned char)c];
+                    total = (total > UINT64_MAX - len) ? UINT64_MAX : total + len;
+                }
+                lengths[gen][(unsigned char)rule.first] = total;
+            }
+        }
+        return lengths;
+    }
+    
+    // Size of a generation, predicted from the rules alone.
+    struct Growth {
+        uint64_t symbols = 0;     // string length; saturates at UINT64_MAX
+        uint64_t segments = 0;    // F, A and B: segments the turtle draws
+        int64_t maxDepth = 0;     // deepest '[' nesting reached; saturates at INT64_MAX
+    };
+    
+    // Exact symbol count, drawn-segment count and maximum bracket depth of
+    // generation N without expanding anything. Each generation is one
+    // product with the growth matrix (rule i contains symbol j k times),
+    // applied per symbol: counts sum over the rule body, and a symbol's
+    // peak depth is the best of (depth before symbol j + peak of j) along
+    // its rule.
+    Growth predict(int generations) const {
+        uint64_t len[256], seg[256];
+        int64_t net[256], peak[256];
+        for(int c = 0; c < 256; c++) {
+            len[c] = 1;
+            seg[c] = (c == 'F' || c == 'A' || c == 'B');
+            net[c] = (c == '[') - (c == ']');
+            peak[c] = std::max<int64_t>(0, net[c]);
+        }
+        auto add = [](uint64_t a, uint64_t b) { return a > UINT64_MAX - b ? UINT64_MAX : a + b; };
+        // Depths saturate too: unbalanced rules grow them without bound.
+        auto addDepth = [](int64_t a, int64_t b) {
+            if(b > 0 && a > INT64_MAX - b) return INT64_MAX;
+            if(b < 0 && a < INT64_MIN - b) return INT64_MIN;
+            return a + b;
+        };
+        auto fold = [&](const std::string& body, uint64_t& l, uint64_t& sg, int64_t& nt, int64_t& pk) {
+            l = sg = 0;
+            nt = pk = 0;
+            for(char ch : body) {
+                unsigned char c = ch;
+                l = add(l, len[c]);
+                sg = add(sg, seg[c]);
+                pk = std::max(pk, addDepth(nt, peak[c]));
+                nt = addDepth(nt, net[c]);
+            }
+        };
+        
+        uint64_t nextLen[256], nextSeg[256];
+        int64_t nextNet[256], nextPeak[256];
+        for(int gen = 0; gen < generations; gen++) {
+            std::copy(len, len + 256, nextLen);
+            std::copy(seg, seg + 256, nextSeg);
+            std::copy(net, net + 256, nextNet);
+            std::copy(peak, peak + 256, nextPeak);
+            for(const auto& rule : rules) {
+                unsigned char c = rule.first;
+                fold(rule.second, nextLen[c], nextSeg[c], nextNet[c], nextPeak[c]);
+            }
+            std::copy(nextLen, nextLen + 256, len);
+            std::copy(nextSeg, nextSeg + 256, seg);
+            std::copy(nextNet, nextNet + 256, net);
+            std::copy(nextPeak, nextPeak + 256, peak);
+        }
+        
+        Growth g;
+        int64_t net0;
+        fold(axiom, g.symbols, g.segments, net0, g.maxDepth);
+        return g;
+    }
+    
+    // Same result as iterate(), rewritten on all cores. Each generation is
+    // split into chunks; per-chunk output sizes are summed in parallel, an
+    // exclusive scan over the chunk sizes gives each chunk its output offset,
+    // and every thread then copies its chunk straight into one preallocated
+    // buffer.
+    void iterateParallel(int generations) {
+        const std::string* table[256] = {};
+        uint64_t length[256];
+        for(int i = 0; i < 256; i++) length[i] = 1;
+        for(const auto& rule : rules) {
+            table[(unsigned char)rule.first] = &rule.second;
+            length[(unsigned char)rule.first] = rule.second.size();
+        }
+        
+        uint64_t finalLength = 0;
+        std::vector<std::vector<uint64_t>> lengths = expansionLengths(generations);
+        for(char c : axiom) {
+            uint64_t len = lengths[generations][(unsigned char)c];
+            finalLength = finalLength > UINT64_MAX - len ? UINT64_MAX : finalLength + len;
+        }
+        
+        // Reserve only what a string can hold; a saturated length means the
+        // expansion cannot fit anyway (callers check withinBudget() first).
+        current = axiom;
+        std::string next;
+        if(finalLength <= current.max_size()) {
+            current.reserve(finalLength);
+            next.reserve(finalLength);
+        }
+        
+        const int chunks = omp_get_max_threads() * 8;
+        std::vector<uint64_t> offsets(chunks + 1);
+        for(int gen = 0; gen < generations; gen++) {
+            const size_t n = current.size();
+            const char* in = current.data();
+            
+            #pragma omp parallel for schedule(static)
+            for(int k = 0; k < chunks; k++) {
+                uint64_t total = 0;
+                for(size_t i = n * k / chunks; i < n * (k + 1) / chunks; i++) {
+                    total += length[(unsigned char)in[i]];
+                }
+                offsets[k + 1] = total;
+            }
+            offsets[0] = 0;
+            for(int k = 0; k < chunks; k++) offsets[k + 1] += offsets[k];
+            
+            next.resize(offsets[chunks]);
+            char* out = &next[0];
+            
+            #pragma omp parallel for schedule(static)
+            for(int k = 0; k < chunks; k++) {
+                char* dst = out + offsets[k];
+                for(size_t i = n * k / chunks; i < n * (k + 1) / chunks; i++) {
+                    const std::string* rule = table[(unsigned char)in[i]];
+                    if(rule) {
+                        std::memcpy(dst, rule->data(), rule->size());
+                        dst += rule->size();
+                    } else {
+                        *dst++ = in[i];
+                    }
+                }
+            }
+            current.swap(next);
+            progress() << "Generation " << gen + 1 << ": Length = " << current.length() << std::endl;
         }
     }
     
     const std::string& getString() const { return current; }
+    const std::string& getAxiom() const { return axiom; }
+    const std::unordered_map<char, std::string>& getRules() const { return rules; }
+};
+
+// Produces the symbols of generation N one at a time, depth first, without
+// ever building the generation-N string. One cursor is kept per generation,
+// each pointing into the axiom or a rule body, so memory stays at
+// O(generations) no matter how long the expanded string would be.
+// The LSystem must outlive the stream.
+class SymbolStream {
+private:
+    struct Cursor {
+        const char* pos;
+        const char* end;
+    };
+    
+    const std::string* table[256];
+    const std::string& axiom;
+    std::vector<Cursor> cursors;
+    int generations;
+    
+public:
+    SymbolStream(const LSystem& ls, int gens) : axiom(ls.getAxiom()), generations(gens) {
+        for(int i = 0; i < 256; i++) table[i] = nullptr;
+        for(const auto& rule : ls.getRules()) {
+            table[(unsigned char)rule.first] = &rule.second;
+        }
+        cursors.reserve(generations + 1);
+        reset();
+    }
+    
+    void reset() {
+        cursors.clear();
+        cursors.push_back({axiom.data(), axiom.data() + axiom.size()});
+    }
+    
+    // Writes the next symbol to c; returns false once the generation is exhausted.
+    bool next(char& c) {
+        while(!cursors.empty()) {
+            Cursor& top = cursors.back();
+            if(top.pos == top.end) {
+                cursors.pop_back();
+                continue;
+            }
+            char symbol = *top.pos++;
+            const std::string* rule = table[(unsigned char)symbol];
+            if(rule && (int)cursors.size() <= generations) {
+                cursors.push_back({rule->data(), rule->data() + rule->size()});
+                continue;
+            }
+            c = symbol;
+            return true;
+        }
+        return false;
+    }
+    
+    // Fills buf with up to n symbols and returns how many were written.
+    size_t read(char* buf, size_t n) {
+        size_t count = 0;
+        while(count < n && next(buf[count])) count++;
+        return count;
+    }
 };
 
 Vec3 hsvToRgb(float h, float s, float v) {
@@ -167,413 +449,4390 @@ Vec3 hsvToRgb(float h, float s, float v) {
     return Vec3(rgb.x + m, rgb.y + m, rgb.z + m);
 }
 
-class TurtleRenderer {
-private:
-    std::vector<Line> lines;
-    std::stack<TurtleState> stateStack;
-    TurtleState turtle;
-    float angle;
-    float stepSize;
-    float widthFactor;
+// A word of modules: symbols plus an optional list of float parameters per
+// module, e.g. F(1.5,2). Parameters of module i are
+// params[paramStart[i] .. paramStart[i + 1]); paramStart stays empty while
+// no module has any, so plain words cost one byte per symbol.
+struct ModuleString {
+    std::string symbols;
+    std::vector<uint32_t> paramStart;
+    std::vector<float> params;
     
-public:
-    TurtleRenderer(float ang = 25.0f, float step = 1.0f) 
-        : angle(ang * M_PI / 180.0f), stepSize(step), widthFactor(0.9f) {}
+    size_t size() const { return symbols.size(); }
+    bool hasParams() const { return !paramStart.empty(); }
+    int paramCount(size_t i) const { return hasParams() ? paramStart[i + 1] - paramStart[i] : 0; }
+    const float* paramsOf(size_t i) const { return params.data() + (hasParams() ? paramStart[i] : 0); }
     
-    void setAngle(float ang) { angle = ang * M_PI / 180.0f; }
-    void setStep(float step) { stepSize = step; }
-    void setWidthFactor(float factor) { widthFactor = factor; }
+    void clear() {
+        symbols.clear();
+        paramStart.clear();
+        params.clear();
+    }
     
-    void interpret(const std::string& lstring) {
-        lines.clear();
-        while(!stateStack.empty()) stateStack.pop();
-        
-        turtle = TurtleState();
-        
-        for(char c : lstring) {
-            switch(c) {
-                case 'F': case 'A': case 'B':
-                    // Draw forward
-                    drawForward();
-                    break;
-                    
-                case 'f':
-                    // Move forward without drawing
-                    moveForward();
-                    break;
-                    
-                case '+':
-                    // Turn left around up axis
-                    turnLeft();
-                    break;
-                    
-                case '-':
-                    // Turn right around up axis
-                    turnRight();
-                    break;
-                    
-                case '&':
-                    // Pitch down around left axis
-                    pitchDown();
-                    break;
-                    
-                case '^':
-                    // Pitch up around left axis
-                    pitchUp();
-                    break;
-                    
-                case '\\':
-                    // Roll left around heading axis
-                    rollLeft();
-                    break;
-                    
-                case '/':
-                    // Roll right around heading axis
-                    rollRight();
-                    break;
-                    
-                case '|':
-                    // Turn around 180 degrees
-                    turnAround();
-                    break;
-                    
-                case '[':
-                    // Push state
-                    stateStack.push(turtle);
-                    turtle.lineWidth *= widthFactor;
-                    break;
-                    
-                case ']':
-                    // Pop state
-                    if(!stateStack.empty()) {
-                        turtle = stateStack.top();
-                        stateStack.pop();
+    void append(char c, const float* p, int n) {
+        if(n > 0 && !hasParams()) paramStart.assign(symbols.size() + 1, 0);
+        symbols += c;
+        params.insert(params.end(), p, p + n);
+        if(hasParams()) paramStart.push_back(params.size());
+    }
+    
+    std::string toString() const {
+        std::ostringstream out;
+        for(size_t i = 0; i < size(); i++) {
+            out << symbols[i];
+            for(int k = 0; k < paramCount(i); k++) {
+                out << (k == 0 ? "(" : ",") << paramsOf(i)[k];
+            }
+            if(paramCount(i) > 0) out << ")";
+        }
+        return out.str();
+    }
+};
+
+// Arithmetic/boolean expression compiled to a small stack machine. Variables
+// are the predecessor's parameters, referenced by position.
+struct Expr {
+    enum Op : uint8_t { Const, Var, Add, Sub, Mul, Div, Pow, Neg, Not,
+                        Lt, Gt, Le, Ge, Eq, Ne, And, Or };
+    struct Instr {
+        Op op;
+        uint8_t var;
+        float value;
+    };
+    static const int maxStack = 32;
+    std::vector<Instr> code;
+    
+    bool empty() const { return code.empty(); }
+    
+    float eval(const float* vars) const {
+        float stack[maxStack];
+        int sp = 0;
+        for(const Instr& in : code) {
+            switch(in.op) {
+                case Const: stack[sp++] = in.value; break;
+                case Var: stack[sp++] = vars[in.var]; break;
+                case Neg: stack[sp - 1] = -stack[sp - 1]; break;
+                case Not: stack[sp - 1] = stack[sp - 1] == 0.0f; break;
+                default: {
+                    float b = stack[--sp], &a = stack[sp - 1];
+                    switch(in.op) {
+                        case Add: a = a + b; break;
+                        case Sub: a = a - b; break;
+                        case Mul: a = a * b; break;
+                        case Div: a = a / b; break;
+                        case Pow: a = std::pow(a, b); break;
+                        case Lt: a = a < b; break;
+                        case Gt: a = a > b; break;
+                        case Le: a = a <= b; break;
+                        case Ge: a = a >= b; break;
+                        case Eq: a = a == b; break;
+                        case Ne: a = a != b; break;
+                        case And: a = a != 0.0f && b != 0.0f; break;
+                        case Or: a = a != 0.0f || b != 0.0f; break;
+                        default: break;
                     }
-                    break;
-                    
-                case '!':
-                    // Decrease line width
-                    turtle.lineWidth *= 0.7f;
-                    break;
-                    
-                case '<':
-                    // Multiply line width
-                    turtle.lineWidth *= 1.4f;
-                    break;
-                    
-                case '>':
-                    // Divide line width
-                    turtle.lineWidth *= 0.7f;
-                    break;
-                    
-                default:
-                    // Ignore unknown symbols
-                    break;
+                }
             }
         }
-        
-        std::cout << "Generated " << lines.size() << " line segments" << std::endl;
+        return sp ? stack[0] : 0.0f;
     }
+};
 
+// Recursive-descent compiler for Expr. Precedence, lowest first:
+// || && (== !=) (< > <= >=) (+ -) (* /) unary(- !) ^
+class ExprCompiler {
+private:
+    const std::string& text;
+    const std::vector<std::string>& vars;
+    size_t pos = 0;
+    int depth = 0, maxDepth = 0;
+    Expr expr;
+    std::string error;
+    
+public:
+    ExprCompiler(const std::string& src, const std::vector<std::string>& names) : text(src), vars(names) {}
     
+    bool compile(Expr& out, std::string& err) {
+        parseOr();
+        skipSpace();
+        if(error.empty() && pos != text.size()) error = "unexpected '" + text.substr(pos) + "'";
+        if(error.empty() && maxDepth > Expr::maxStack) error = "expression too deep";
+        err = error;
+        out = expr;
+        return error.empty();
+    }
     
 private:
-    void drawForward() {
-        Vec3 newPos = turtle.position + turtle.heading * stepSize;
-        lines.push_back({turtle.position, newPos, turtle.lineWidth, turtle.color});
-        turtle.position = newPos;
+    void skipSpace() { while(pos < text.size() && std::isspace((unsigned char)text[pos])) pos++; }
+    
+    bool accept(const char* op) {
+        skipSpace();
+        size_t n = std::strlen(op);
+        if(text.compare(pos, n, op) != 0) return false;
+        // Don't read the '<' of "<=" as '<'.
+        if(n == 1 && pos + 1 < text.size() && text[pos + 1] == '=' && std::strchr("<>!=", op[0])) return false;
+        pos += n;
+        return true;
     }
     
-    void moveForward() {
-        turtle.position = turtle.position + turtle.heading * stepSize;
+    void emit(Expr::Op op, float value = 0.0f, uint8_t var = 0) {
+        expr.code.push_back({op, var, value});
+        if(op == Expr::Const || op == Expr::Var) {
+            maxDepth = std::max(maxDepth, ++depth);
+        } else if(op != Expr::Neg && op != Expr::Not) {
+            depth--;
+        }
     }
     
-    void turnLeft() {
-        Matrix3 rot = Matrix3::rotationZ(angle);
-        turtle.heading = rot * turtle.heading;
-        turtle.left = rot * turtle.left;
+    void parseOr() {
+        parseAnd();
+        while(error.empty() && accept("||")) { parseAnd(); emit(Expr::Or); }
+    }
+    void parseAnd() {
+        parseEquality();
+        while(error.empty() && accept("&&")) { parseEquality(); emit(Expr::And); }
+    }
+    void parseEquality() {
+        parseCompare();
+        while(error.empty()) {
+            if(accept("==")) { parseCompare(); emit(Expr::Eq); }
+            else if(accept("!=")) { parseCompare(); emit(Expr::Ne); }
+            else break;
+        }
+    }
+    void parseCompare() {
+        parseAdd();
+        while(error.empty()) {
+            if(accept("<=")) { parseAdd(); emit(Expr::Le); }
+            else if(accept(">=")) { parseAdd(); emit(Expr::Ge); }
+            else if(accept("<")) { parseAdd(); emit(Expr::Lt); }
+            else if(accept(">")) { parseAdd(); emit(Expr::Gt); }
+            else break;
+        }
+    }
+    void parseAdd() {
+        parseMul();
+        while(error.empty()) {
+            if(accept("+")) { parseMul(); emit(Expr::Add); }
+            else if(accept("-")) { parseMul(); emit(Expr::Sub); }
+            else break;
+        }
+    }
+    void parseMul() {
+        parseUnary();
+        while(error.empty()) {
+            if(accept("*")) { parseUnary(); emit(Expr::Mul); }
+            else if(accept("/")) { parseUnary(); emit(Expr::Div); }
+            else break;
+        }
+    }
+    void parseUnary() {
+        if(accept("-")) { parseUnary(); emit(Expr::Neg); }
+        else if(accept("!")) { parseUnary(); emit(Expr::Not); }
+        else parsePow();
+    }
+    void parsePow() {
+        parsePrimary();
+        if(error.empty() && accept("^")) { parseUnary(); emit(Expr::Pow); }
+    }
+    void parsePrimary() {
+        skipSpace();
+        if(pos >= text.size()) {
+            error = "unexpected end of expression";
+        } else if(accept("(")) {
+            parseOr();
+            if(error.empty() && !accept(")")) error = "missing ')'";
+        } else if(std::isdigit((unsigned char)text[pos]) || text[pos] == '.') {
+            char* end;
+            float v = std::strtof(text.c_str() + pos, &end);
+            pos = end - text.c_str();
+            emit(Expr::Const, v);
+        } else if(std::isalpha((unsigned char)text[pos]) || text[pos] == '_') {
+            size_t start = pos;
+            while(pos < text.size() && (std::isalnum((unsigned char)text[pos]) || text[pos] == '_')) pos++;
+            std::string name = text.substr(start, pos - start);
+            auto found = std::find(vars.begin(), vars.end(), name);
+            if(found == vars.end()) {
+                error = "unknown variable '" + name + "'";
+            } else {
+                emit(Expr::Var, 0.0f, (uint8_t)(found - vars.begin()));
+            }
+        } else {
+            error = std::string("unexpected '") + text[pos] + "'";
+        }
     }
+};
+
+// L-system with stochastic, context-sensitive and parametric rules.
+//
+// Rules are written as text:
+//
+//   [left < ] pred [ > right] [: condition] -> successor
+//
+// where left, pred and right are single modules like A or F(l,w) whose
+// parameter names become variables, the condition is an expression, and the
+// successor is a module list whose parameters are expressions, e.g.
+//
+//   F(x,t) : t == 0 -> F(x*0.3,2)+F(x*0.46,1)--F(x*0.46,1)+F(x*0.7,0)
+//   0 < 1 > 0 -> 1
+//
+// The context separators need spaces around them (" < ", " > ") since '<'
+// and '>' are turtle symbols too. A module matches a predecessor with the
+// same symbol and parameter count. Contexts are searched bracket-aware: to
+// the left, enclosing '[' are stepped over and closed branches skipped; to
+// the right, branches are skipped and a ']' ends the search. Symbols given
+// to setIgnore() are invisible to context matching. Among the rules that
+// match, those with the most context win, and one of them is picked by
+// weight from a generator seeded by (seed, generation, position), so results
+// do not depend on the thread count. Modules without a matching rule are
+// copied unchanged.
+class ParametricLSystem {
+private:
+    struct ModuleTemplate {
+        char symbol;
+        std::vector<Expr> args;
+    };
     
-    void turnRight() {
-        Matrix3 rot = Matrix3::rotationZ(-angle);
-        turtle.heading = rot * turtle.heading;
-        turtle.left = rot * turtle.left;
+    struct Rule {
+        char left = 0, pred = 0, right = 0;          // 0: no context
+        int leftParams = 0, predParams = 0, rightParams = 0;
+        Expr condition;
+        float weight = 1.0f;
+        std::vector<ModuleTemplate> successor;
+        int successorParams = 0;
+        bool copyOnly = false;   // no variables: successor parameters are constants
+        std::string text;        // successor symbols, for the parameterless case
+        
+        int contexts() const { return (left != 0) + (right != 0); }
+    };
+    
+    ModuleString axiom, current;
+    std::vector<Rule> rules;
+    // Dense dispatch: rules for symbol c are order[first[c] .. first[c + 1]).
+    std::vector<int> order;
+    int first[257] = {};
+    bool ignore[256] = {};
+    bool hasContext = false;
+    // Symbols with exactly one rule that has no context, condition or
+    // parameters: rewritten without looking at the rule list.
+    int fixedRule[256];
+    uint64_t seed;
+    
+public:
+    explicit ParametricLSystem(const std::string& ax, uint64_t rngSeed = 1) : seed(rngSeed) {
+        std::fill(fixedRule, fixedRule + 256, -1);
+        std::string error;
+        std::vector<std::string> none;
+        if(!parseModules(ax, none, nullptr, &axiom, error)) {
+            std::cerr << "Bad axiom '" << ax << "': " << error << std::endl;
+        }
+        current = axiom;
     }
     
-    void pitchDown() {
-        Matrix3 rot = Matrix3::rotationX(angle);
-        turtle.heading = rot * turtle.heading;
-        turtle.up = rot * turtle.up;
+    // Plain char -> string rules of an LSystem, for comparison with it. The
+    // strings are copied symbol by symbol rather than parsed as module text:
+    // spaces and parentheses are ordinary symbols in a plain grammar.
+    explicit ParametricLSystem(const LSystem& ls, uint64_t rngSeed = 1) : seed(rngSeed) {
+        std::fill(fixedRule, fixedRule + 256, -1);
+        for(char c : ls.getAxiom()) axiom.append(c, nullptr, 0);
+        current = axiom;
+        for(const auto& rule : ls.getRules()) {
+            Rule r;
+            r.pred = rule.first;
+            for(char c : rule.second) r.successor.push_back(ModuleTemplate{c, {}});
+            r.text = rule.second;
+            r.copyOnly = true;
+            insertRule(r);
+        }
     }
     
-    void pitchUp() {
-        Matrix3 rot = Matrix3::rotationX(-angle);
-        turtle.heading = rot * turtle.heading;
-        turtle.up = rot * turtle.up;
+    void setIgnore(const std::string& symbols) {
+        for(int i = 0; i < 256; i++) ignore[i] = false;
+        for(char c : symbols) ignore[(unsigned char)c] = true;
     }
     
-    void rollLeft() {
-        Matrix3 rot = Matrix3::rotationY(angle);
-        turtle.left = rot * turtle.left;
-        turtle.up = rot * turtle.up;
+    bool addRule(const std::string& text, float weight = 1.0f) {
+        std::string error;
+        Rule rule;
+        rule.weight = weight;
+        if(!parseRule(text, rule, error)) {
+            std::cerr << "Bad rule '" << text << "': " << error << std::endl;
+            return false;
+        }
+        insertRule(rule);
+        return true;
     }
     
-    void rollRight() {
-        Matrix3 rot = Matrix3::rotationY(-angle);
-        turtle.left = rot * turtle.left;
-        turtle.up = rot * turtle.up;
+    void iterate(int generations) {
+        current = axiom;
+        ModuleString next;
+        for(int gen = 0; gen < generations; gen++) {
+            rewrite(current, next, gen);
+            std::swap(current, next);
+            progress() << "Generation " << gen + 1 << ": Length = " << current.size() << std::endl;
+        }
     }
     
-    void turnAround() {
-        turtle.heading = turtle.heading * -1.0f;
-        turtle.left = turtle.left * -1.0f;
+    const ModuleString& getWord() const { return current; }
+    
+private:
+    void insertRule(const Rule& rule) {
+        hasContext = hasContext || rule.contexts() > 0;
+        rules.push_back(rule);
+        
+        // Rebuild the dispatch table; rules keep their insertion order per symbol.
+        order.resize(rules.size());
+        int count[256] = {};
+        for(const Rule& r : rules) count[(unsigned char)r.pred]++;
+        first[0] = 0;
+        for(int c = 0; c < 256; c++) first[c + 1] = first[c] + count[c];
+        int fill[256];
+        std::copy(first, first + 256, fill);
+        for(size_t r = 0; r < rules.size(); r++) order[fill[(unsigned char)rules[r].pred]++] = r;
+        for(int c = 0; c < 256; c++) {
+            const Rule* only = count[c] == 1 ? &rules[order[first[c]]] : nullptr;
+            bool fixed = only && only->copyOnly && only->contexts() == 0 &&
+                         only->condition.empty() && only->predParams == 0;
+            fixedRule[c] = fixed ? order[first[c]] : -1;
+        }
     }
     
-public:
-
-    void renderToSVGEnhanced(const std::string& filename, float scale = 10.0f, 
-                            const std::string& style = "gradient") {
-        if(lines.empty()) return;
+    // One parallel rewrite step: choose a rule for every module and count its
+    // output, exclusive-scan the counts per chunk, then write every chunk
+    // straight into place.
+    void rewrite(const ModuleString& in, ModuleString& out, int gen) {
+        const size_t n = in.size();
+        std::vector<int32_t> match;
+        if(hasContext) matchBrackets(in, match);
         
-        // Find bounding box
-        Vec3 minBounds = lines[0].start;
-        Vec3 maxBounds = lines[0].start;
+        std::vector<int32_t> chosen(n), leftAt(hasContext ? n : 0), rightAt(hasContext ? n : 0);
+        const int chunks = omp_get_max_threads() * 8;
+        std::vector<uint64_t> symOffset(chunks + 1, 0), parOffset(chunks + 1, 0);
         
-        for(const Line& line : lines) {
-            minBounds.x = std::min(minBounds.x, std::min(line.start.x, line.end.x));
-            minBounds.y = std::min(minBounds.y, std::min(line.start.y, line.end.y));
-            maxBounds.x = std::max(maxBounds.x, std::max(line.start.x, line.end.x));
-            maxBounds.y = std::max(maxBounds.y, std::max(line.start.y, line.end.y));
+        #pragma omp parallel for schedule(static)
+        for(int k = 0; k < chunks; k++) {
+            uint64_t syms = 0, pars = 0;
+            float vars[48];
+            for(size_t i = n * k / chunks; i < n * (k + 1) / chunks; i++) {
+                int32_t left, right;
+                int r = chooseRule(in, match, i, gen, left, right, vars);
+                if(hasContext) {
+                    leftAt[i] = left;
+                    rightAt[i] = right;
+                }
+                chosen[i] = r;
+                if(r < 0) {
+                    syms += 1;
+                    pars += in.paramCount(i);
+                } else {
+                    syms += rules[r].successor.size();
+                    pars += rules[r].successorParams;
+                }
+            }
+            symOffset[k + 1] = syms;
+            parOffset[k + 1] = pars;
+        }
+        for(int k = 0; k < chunks; k++) {
+            symOffset[k + 1] += symOffset[k];
+            parOffset[k + 1] += parOffset[k];
         }
         
-        float width = (maxBounds.x - minBounds.x) * scale + 200;
-        float height = (maxBounds.y - minBounds.y) * scale + 200;
+        const bool withParams = parOffset[chunks] > 0;
+        out.symbols.resize(symOffset[chunks]);
+        out.params.resize(parOffset[chunks]);
+        out.paramStart.clear();
+        if(withParams) out.paramStart.resize(symOffset[chunks] + 1, 0);
         
-        std::ofstream file(filename);
-        file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-        file << "<svg width=\"" << width << "\" height=\"" << height << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+        #pragma omp parallel for schedule(static)
+        for(int k = 0; k < chunks; k++) {
+            size_t s = symOffset[k], p = parOffset[k];
+            float vars[48];
+            for(size_t i = n * k / chunks; i < n * (k + 1) / chunks; i++) {
+                int r = chosen[i];
+                if(r < 0) {
+                    out.symbols[s++] = in.symbols[i];
+                    for(int a = 0; a < in.paramCount(i); a++) out.params[p++] = in.paramsOf(i)[a];
+                    if(withParams) out.paramStart[s] = p;
+                    continue;
+                }
+                const Rule& rule = rules[r];
+                if(rule.successorParams == 0) {
+                    std::memcpy(&out.symbols[s], rule.text.data(), rule.text.size());
+                    if(withParams) {
+                        std::fill(&out.paramStart[s + 1], &out.paramStart[s + 1] + rule.text.size(), (uint32_t)p);
+                    }
+                    s += rule.text.size();
+                    continue;
+                }
+                if(!rule.copyOnly) {
+                    bindVars(in, rule, hasContext ? leftAt[i] : -1, i, hasContext ? rightAt[i] : -1, vars);
+                }
+                for(const ModuleTemplate& m : rule.successor) {
+                    out.symbols[s++] = m.symbol;
+                    for(const Expr& e : m.args) out.params[p++] = e.eval(vars);
+                    out.paramStart[s] = p;
+                }
+            }
+        }
+    }
+    
+    static void matchBrackets(const ModuleString& w, std::vector<int32_t>& match) {
+        match.assign(w.size(), -1);
+        std::vector<int32_t> open;
+        for(size_t i = 0; i < w.size(); i++) {
+            if(w.symbols[i] == '[') {
+                open.push_back(i);
+            } else if(w.symbols[i] == ']' && !open.empty()) {
+                match[i] = open.back();
+                match[open.back()] = i;
+                open.pop_back();
+            }
+        }
+    }
+    
+    int leftContext(const ModuleString& w, const std::vector<int32_t>& match, size_t i) const {
+        for(int64_t j = (int64_t)i - 1; j >= 0; j--) {
+            char c = w.symbols[j];
+            if(c == ']') {
+                if(match[j] < 0) return -1;
+                j = match[j];            // skip the closed branch
+            } else if(c != '[' && !ignore[(unsigned char)c]) {
+                return j;
+            }
+        }
+        return -1;
+    }
+    
+    int rightContext(const ModuleString& w, const std::vector<int32_t>& match, size_t i) const {
+        for(size_t j = i + 1; j < w.size(); j++) {
+            char c = w.symbols[j];
+            if(c == '[') {
+                if(match[j] < 0) return -1;
+                j = match[j];            // skip the branch
+            } else if(c == ']') {
+                return -1;               // end of this branch
+            } else if(!ignore[(unsigned char)c]) {
+                return j;
+            }
+        }
+        return -1;
+    }
+    
+    // Variables are laid out left params, predecessor params, right params.
+    void bindVars(const ModuleString& w, const Rule& rule, int left, size_t i, int right, float* vars) const {
+        int v = 0;
+        for(int a = 0; a < rule.leftParams; a++) vars[v++] = w.paramsOf(left)[a];
+        for(int a = 0; a < rule.predParams; a++) vars[v++] = w.paramsOf(i)[a];
+        for(int a = 0; a < rule.rightParams; a++) vars[v++] = w.paramsOf(right)[a];
+    }
+    
+    int chooseRule(const ModuleString& w, const std::vector<int32_t>& match, size_t i, int gen,
+                   int32_t& leftAt, int32_t& rightAt, float* vars) const {
+        const unsigned char c = w.symbols[i];
+        leftAt = rightAt = -1;
+        if(fixedRule[c] >= 0 && w.paramCount(i) == 0) return fixedRule[c];
+        if(first[c] == first[c + 1]) return -1;
         
-        // Enhanced background with gradient
-        file << "<defs>\n";
+        int left = -1, right = -1;
+        if(hasContext) {
+            left = leftContext(w, match, i);
+            right = rightContext(w, match, i);
+        }
         
-        if(style == "gradient" || style == "rainbow") {
-            // Background gradient
-            file << "<radialGradient id=\"bg\" cx=\"50%\" cy=\"50%\" r=\"50%\">\n";
-            file << "<stop offset=\"0%\" style=\"stop-color:#001122;stop-opacity:1\" />\n";
-            file << "<stop offset=\"100%\" style=\"stop-color:#000000;stop-opacity:1\" />\n";
-            file << "</radialGradient>\n";
-            
-            // Line gradients for depth effect
-            for(int i = 0; i < std::min((int)lines.size(), 10); i++) {
-                file << "<linearGradient id=\"lineGrad" << i << "\" x1=\"0%\" y1=\"0%\" x2=\"100%\" y2=\"100%\">\n";
-                
-                if(style == "rainbow") {
-                    float hue1 = std::fmod(i * 137.5f, 360.0f);
-                    float hue2 = std::fmod(hue1 + 60.0f, 360.0f);
-                    Vec3 color1 = hsvToRgb(hue1, 0.8f, 0.9f);
-                    Vec3 color2 = hsvToRgb(hue2, 0.6f, 0.7f);
-                    
-                    file << "<stop offset=\"0%\" style=\"stop-color:rgb(" 
-                         << (int)(color1.x*255) << "," << (int)(color1.y*255) << "," << (int)(color1.z*255) << ");stop-opacity:0.9\" />\n";
-                    file << "<stop offset=\"100%\" style=\"stop-color:rgb(" 
-                         << (int)(color2.x*255) << "," << (int)(color2.y*255) << "," << (int)(color2.z*255) << ");stop-opacity:0.6\" />\n";
-                } else {
-                    // Green to yellow gradient for organic look
-                    file << "<stop offset=\"0%\" style=\"stop-color:#90EE90;stop-opacity:0.9\" />\n";
-                    file << "<stop offset=\"100%\" style=\"stop-color:#32CD32;stop-opacity:0.6\" />\n";
-                }
-                file << "</linearGradient>\n";
+        // Candidates with the most context; at most maxCandidates are kept.
+        const int maxCandidates = 32;
+        int candidates[maxCandidates];
+        int count = 0, bestContexts = -1;
+        float total = 0.0f;
+        for(int k = first[c]; k < first[c + 1]; k++) {
+            const Rule& rule = rules[order[k]];
+            if(rule.predParams != w.paramCount(i)) continue;
+            if(rule.left && (left < 0 || w.symbols[left] != rule.left || w.paramCount(left) != rule.leftParams)) continue;
+            if(rule.right && (right < 0 || w.symbols[right] != rule.right || w.paramCount(right) != rule.rightParams)) continue;
+            if(rule.contexts() < bestContexts) continue;
+            if(!rule.condition.empty()) {
+                bindVars(w, rule, left, i, right, vars);
+                if(rule.condition.eval(vars) == 0.0f) continue;
+            }
+            if(rule.contexts() > bestContexts) {
+                bestContexts = rule.contexts();
+                count = 0;
+                total = 0.0f;
+            }
+            if(count < maxCandidates) {
+                candidates[count++] = order[k];
+                total += rule.weight;
             }
-            
-            // Glow filter
-            file << "<filter id=\"glow\">\n";
-            file << "<feGaussianBlur stdDeviation=\"2\" result=\"coloredBlur\"/>\n";
-            file << "<feMerge>\n";
-            file << "<feMergeNode in=\"coloredBlur\"/>\n";
-            file << "<feMergeNode in=\"SourceGraphic\"/>\n";
-            file << "</feMerge>\n";
-            file << "</filter>\n";
         }
+        if(count == 0) return -1;
         
-        file << "</defs>\n";
-        
-        // Background
-        if(style == "gradient" || style == "rainbow") {
-            file << "<rect width=\"100%\" height=\"100%\" fill=\"url(#bg)\"/>\n";
-        } else if(style == "light") {
-            file << "<rect width=\"100%\" height=\"100%\" fill=\"#f8f8f8\"/>\n";
-        } else {
-            file << "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+        int best = candidates[0];
+        if(count > 1) {
+            float pick = uniform(gen, i) * total;
+            for(int k = 0; k < count; k++) {
+                best = candidates[k];
+                pick -= rules[best].weight;
+                if(pick < 0.0f) break;
+            }
         }
-        
-        // Render lines with enhanced styling
-        for(int i = 0; i < lines.size(); i++) {
-            const Line& line = lines[i];
-            float x1 = (line.start.x - minBounds.x) * scale + 100;
-            float y1 = height - ((line.start.y - minBounds.y) * scale + 100);
-            float x2 = (line.end.x - minBounds.x) * scale + 100;
-            float y2 = height - ((line.end.y - minBounds.y) * scale + 100);
-            
-            std::string strokeColor;
-            std::string filter = "";
-            float strokeWidth = std::max(0.5f, line.width * 0.8f);
-            
-            if(style == "rainbow") {
-                float hue = std::fmod(i * 137.5f, 360.0f);
-                Vec3 color = hsvToRgb(hue, 0.7f, 0.9f);
-                strokeColor = "rgb(" + std::to_string((int)(color.x*255)) + "," + 
-                             std::to_string((int)(color.y*255)) + "," + 
-                             std::to_string((int)(color.z*255)) + ")";
-                filter = " filter=\"url(#glow)\"";
-            } else if(style == "gradient") {
-                strokeColor = "url(#lineGrad" + std::to_string(i % 10) + ")";
-                filter = " filter=\"url(#glow)\"";
-            } else if(style == "light") {
-                int r = (int)(line.color.x * 180 + 75);
-                int g = (int)(line.color.y * 180 + 75);
-                int b = (int)(line.color.z * 180 + 75);
-                strokeColor = "rgb(" + std::to_string(r) + "," + std::to_string(g) + "," + std::to_string(b) + ")";
-            } else if(style == "depth") {
-                // Color based on distance from center for depth effect
-                float centerX = width / 2;
-                float centerY = height / 2;
-                float dist = std::sqrt((x1-centerX)*(x1-centerX) + (y1-centerY)*(y1-centerY));
-                float maxDist = std::sqrt(centerX*centerX + centerY*centerY);
-                float intensity = 1.0f - (dist / maxDist) * 0.7f;
-                
-                int r = (int)(line.color.x * 255 * intensity);
-                int g = (int)(line.color.y * 255 * intensity);
-                int b = (int)(line.color.z * 255 * intensity);
-                strokeColor = "rgb(" + std::to_string(r) + "," + std::to_string(g) + "," + std::to_string(b) + ")";
-                strokeWidth *= intensity;
-            } else {
-                // Default style
-                int r = (int)(line.color.x * 255);
-                int g = (int)(line.color.y * 255);
-                int b = (int)(line.color.z * 255);
-                strokeColor = "rgb(" + std::to_string(r) + "," + std::to_string(g) + "," + std::to_string(b) + ")";
+        leftAt = left;
+        rightAt = right;
+        return best;
+    }
+    
+    float uniform(int gen, size_t i) const {
+        uint64_t z = seed * 0x9E3779B97F4A7C15ULL + ((uint64_t)gen << 40) + i;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        return (z >> 40) * (1.0f / 16777216.0f);
+    }
+    
+    static std::string trim(const std::string& s) {
+        size_t b = s.find_first_not_of(" \t"), e = s.find_last_not_of(" \t");
+        return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+    }
+    
+    // Parses one module "X" or "X(a,b)". Formal parameters are appended to
+    // `names`.
+    static bool parseFormal(const std::string& text, char& symbol, int& params,
+                            std::vector<std::string>& names, std::string& error) {
+        std::string t = trim(text);
+        if(t.empty()) {
+            error = "missing module";
+            return false;
+        }
+        symbol = t[0];
+        params = 0;
+        if(t.size() == 1) return true;
+        if(t[1] != '(' || t.back() != ')') {
+            error = "bad module '" + t + "'";
+            return false;
+        }
+        std::stringstream list(t.substr(2, t.size() - 3));
+        for(std::string name; std::getline(list, name, ',');) {
+            names.push_back(trim(name));
+            params++;
+        }
+        return true;
+    }
+    
+    // Parses a module list. With `templates` the arguments are compiled
+    // against `vars`; with `constants` they are evaluated right away.
+    static bool parseModules(const std::string& text, const std::vector<std::string>& vars,
+                             std::vector<ModuleTemplate>* templates, ModuleString* constants,
+                             std::string& error) {
+        for(size_t i = 0; i < text.size(); i++) {
+            char c = text[i];
+            if(std::isspace((unsigned char)c)) continue;
+            ModuleTemplate m{c, {}};
+            if(i + 1 < text.size() && text[i + 1] == '(') {
+                int level = 0;
+                size_t start = i + 2, j = i + 1;
+                for(; j < text.size(); j++) {
+                    if(text[j] == '(') level++;
+                    else if(text[j] == ')' && --level == 0) break;
+                    else if(text[j] == ',' && level == 1) {
+                        m.args.emplace_back();
+                        if(!ExprCompiler(text.substr(start, j - start), vars).compile(m.args.back(), error)) return false;
+                        start = j + 1;
+                    }
+                }
+                if(j >= text.size()) {
+                    error = "missing ')'";
+                    return false;
+                }
+                m.args.emplace_back();
+                if(!ExprCompiler(text.substr(start, j - start), vars).compile(m.args.back(), error)) return false;
+                i = j;
+            }
+            if(templates) templates->push_back(m);
+            if(constants) {
+                float values[64];
+                int count = std::min<int>(m.args.size(), 64);
+                for(int a = 0; a < count; a++) values[a] = m.args[a].eval(nullptr);
+                constants->append(c, values, count);
             }
-            
-            file << "<line x1=\"" << x1 << "\" y1=\"" << y1 
-                 << "\" x2=\"" << x2 << "\" y2=\"" << y2 
-                 << "\" stroke=\"" << strokeColor
-                 << "\" stroke-width=\"" << strokeWidth 
-                 << "\" stroke-linecap=\"round\""
-                 << filter << "/>\n";
         }
-        
-        file << "</svg>\n";
-        file.close();
-        std::cout << "Enhanced SVG file saved: " << filename << std::endl;
+        return true;
     }
     
-    void renderToSVG(const std::string& filename, float scale = 10.0f) {
-        if(lines.empty()) return;
-        
-        // Find bounding box
-        Vec3 minBounds = lines[0].start;
-        Vec3 maxBounds = lines[0].start;
-        
-        for(const Line& line : lines) {
-            minBounds.x = std::min(minBounds.x, std::min(line.start.x, line.end.x));
-            minBounds.y = std::min(minBounds.y, std::min(line.start.y, line.end.y));
-            maxBounds.x = std::max(maxBounds.x, std::max(line.start.x, line.end.x));
-            maxBounds.y = std::max(maxBounds.y, std::max(line.start.y, line.end.y));
+    static bool parseRule(const std::string& text, Rule& rule, std::string& error) {
+        size_t arrow = text.find("->");
+        if(arrow == std::string::npos) {
+            error = "missing '->'";
+            return false;
+        }
+        std::string lhs = text.substr(0, arrow), condition;
+        size_t colon = lhs.find(':');
+        if(colon != std::string::npos) {
+            condition = lhs.substr(colon + 1);
+            lhs = lhs.substr(0, colon);
         }
         
-        float width = (maxBounds.x - minBounds.x) * scale + 100;
-        float height = (maxBounds.y - minBounds.y) * scale + 100;
-        
-        std::ofstream file(filename);
-        file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-        file << "<svg width=\"" << width << "\" height=\"" << height << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
-        file << "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+        std::string leftText, rightText;
+        size_t lt = lhs.find(" < ");
+        if(lt != std::string::npos) {
+            leftText = lhs.substr(0, lt);
+            lhs = lhs.substr(lt + 3);
+        }
+        size_t gt = lhs.find(" > ");
+        if(gt != std::string::npos) {
+            rightText = lhs.substr(gt + 3);
+            lhs = lhs.substr(0, gt);
+        }
         
-        for(const Line& line : lines) {
-            float x1 = (line.start.x - minBounds.x) * scale + 50;
-            float y1 = height - ((line.start.y - minBounds.y) * scale + 50);
-            float x2 = (line.end.x - minBounds.x) * scale + 50;
-            float y2 = height - ((line.end.y - minBounds.y) * scale + 50);
-            
-            int r = (int)(line.color.x * 255);
-            int g = (int)(line.color.y * 255);
-            int b = (int)(line.color.z * 255);
-            
-            file << "<line x1=\"" << x1 << "\" y1=\"" << y1 
-                 << "\" x2=\"" << x2 << "\" y2=\"" << y2 
-                 << "\" stroke=\"rgb(" << r << "," << g << "," << b 
-                 << ")\" stroke-width=\"" << (line.width * 0.5f) << "\"/>\n";
+        std::vector<std::string> vars;
+        if(!leftText.empty() && !parseFormal(leftText, rule.left, rule.leftParams, vars, error)) return false;
+        if(!parseFormal(lhs, rule.pred, rule.predParams, vars, error)) return false;
+        if(!rightText.empty() && !parseFormal(rightText, rule.right, rule.rightParams, vars, error)) return false;
+        if(vars.size() > 48) {
+            error = "too many parameters";
+            return false;
         }
         
-        file << "</svg>\n";
-        file.close();
-        std::cout << "SVG file saved: " << filename << std::endl;
+        if(!trim(condition).empty() &&
+           !ExprCompiler(trim(condition), vars).compile(rule.condition, error)) return false;
+        if(!parseModules(text.substr(arrow + 2), vars, &rule.successor, nullptr, error)) return false;
+        for(const ModuleTemplate& m : rule.successor) {
+            rule.successorParams += m.args.size();
+            rule.text += m.symbol;
+        }
+        rule.copyOnly = vars.empty();
+        return true;
     }
 };
 
-// Predefined L-Systems
-namespace LSystems {
-    LSystem dragonCurve() {
-        LSystem ls("F");
-        ls.addRule('F', "F+G");
-        ls.addRule('G', "F-G");
-        return ls;
+// Receives segments as the turtle produces them, together with the turtle
+// state at the start of the segment.
+class SegmentSink {
+public:
+    virtual ~SegmentSink() {}
+    virtual void segment(const Line& line, const TurtleState& state) = 0;
+};
+
+// Per-vector rotation applied by a run of turn symbols. Each turn rotates a
+// different pair of the heading/left/up vectors, so a folded run keeps one
+// composed matrix per vector.
+struct TurtleRotation {
+    Matrix3 heading, left, up;
+    uint8_t touched = 0;   // bit 0: heading, bit 1: left, bit 2: up
+};
+
+enum class TurtleOp : uint8_t {
+    None,      // symbol the turtle ignores
+    Draw,      // draw `count` forward segments
+    Move,      // move forward by `value` without drawing
+    Rotate,    // apply rotations[index]
+    Push,      // push state, then scale width by the renderer's width factor
+    Pop,
+    Scale      // multiply line width by `value`
+};
+
+struct TurtleInstr {
+    TurtleOp op;
+    uint32_t index;   // draw count or rotation index
+    float value;
+};
+
+// Compact form of an L-system string for one renderer configuration: runs of
+// turns are folded into one precomputed rotation, runs of F/A/B into one
+// multi-segment draw, runs of f into one move, and unknown symbols dropped.
+struct TurtleProgram {
+    std::vector<TurtleInstr> code;
+    std::vector<TurtleRotation> rotations;
+    size_t symbols = 0;   // length of the source string
+};
+
+// Camera for drawing 3D segments: the direction it looks along, and for a
+// perspective view the vertical field of view. Screen "up" follows +y (the
+// turtle's initial heading) unless the camera looks along y.
+struct Camera {
+    Vec3 direction = Vec3(-0.6f, -0.35f, -1.0f);
+    bool perspective = false;
+    float fov = 45.0f;   // degrees
+};
+
+// Text helpers for the chunked SVG writer: std::to_chars into a reused
+// buffer instead of ostream formatting.
+inline void appendFixed(std::string& out, float v) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::fixed, 2);
+    out.append(buf, res.ptr);
+}
+
+inline void appendInt(std::string& out, int v) {
+    char buf[16];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr);
+}
+
+// Threads a parallel region started here would get: 1 inside a task or
+// region when nesting is off (the --batch tasks), else the usual count.
+inline int availableThreads() {
+    if(omp_get_active_level() >= omp_get_max_active_levels()) return 1;
+    return omp_get_max_threads();
+}
+
+// Stable parallel LSD radix sort of (key << 32 | index) items on their
+// 16-bit keys: two 8-bit passes, each a counting sort with per-thread
+// histograms over the same static blocks, scattered through offsets ordered
+// by digit first and thread second, so equal keys keep their input order.
+// Callers pack the index in 32 bits, so at most UINT32_MAX items.
+inline void radixSortKeys16(std::vector<uint64_t>& items) {
+    const size_t n = items.size();
+    const int threads = omp_get_max_threads();
+    std::vector<uint64_t> sorted(n);
+    std::vector<size_t> counts((size_t)threads * 256);
+    for(int shift = 32; shift < 48; shift += 8) {
+        std::fill(counts.begin(), counts.end(), 0);
+        #pragma omp parallel num_threads(threads)
+        {
+            size_t* local = &counts[(size_t)omp_get_thread_num() * 256];
+            #pragma omp for schedule(static)
+            for(size_t i = 0; i < n; i++) local[(items[i] >> shift) & 255]++;
+            #pragma omp single
+            {
+                size_t total = 0;
+                for(int d = 0; d < 256; d++) {
+                    for(int t = 0; t < threads; t++) {
+                        size_t c = counts[(size_t)t * 256 + d];
+                        counts[(size_t)t * 256 + d] = total;
+                        total += c;
+                    }
+                }
+            }
+            #pragma omp for schedule(static)
+            for(size_t i = 0; i < n; i++) sorted[local[(items[i] >> shift) & 255]++] = items[i];
+        }
+        items.swap(sorted);
     }
-    
-    LSystem sierpinskiTriangle() {
-        LSystem ls("F-G-G");
-        ls.addRule('F', "F-G+F+G-F");
-        ls.addRule('G', "GG");
-        return ls;
+}
+
+// 2D bounds of a segment list.
+inline void lineBounds(const std::vector<Line>& lines, Vec3& minBounds, Vec3& maxBounds) {
+    minBounds = maxBounds = lines.empty() ? Vec3() : lines[0].start;
+    for(const Line& line : lines) {
+        minBounds.x = std::min(minBounds.x, std::min(line.start.x, line.end.x));
+        minBounds.y = std::min(minBounds.y, std::min(line.start.y, line.end.y));
+        maxBounds.x = std::max(maxBounds.x, std::max(line.start.x, line.end.x));
+        maxBounds.y = std::max(maxBounds.y, std::max(line.start.y, line.end.y));
+    }
+}
+
+inline bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Writes the chunks to `filename` in order. Names ending in .svgz are gzip
+// compressed, every chunk in parallel as its own gzip member; concatenated
+// members still form one valid gzip file. Compression needs -DLSYSTEM_ZLIB.
+inline bool writeChunks(const std::string& filename, std::vector<std::string>& chunks) {
+    if(endsWith(filename, ".svgz")) {
+#ifdef LSYSTEM_ZLIB
+        bool ok = true;
+        #pragma omp parallel for schedule(dynamic, 1) reduction(&&:ok)
+        for(int i = 0; i < (int)chunks.size(); i++) {
+            z_stream zs = {};
+            if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                ok = false;
+                continue;
+            }
+            std::string packed(deflateBound(&zs, chunks[i].size()), '\0');
+            zs.next_in = (Bytef*)chunks[i].data();
+            zs.avail_in = chunks[i].size();
+            zs.next_out = (Bytef*)&packed[0];
+            zs.avail_out = packed.size();
+            ok = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+            packed.resize(zs.total_out);
+            deflateEnd(&zs);
+            chunks[i].swap(packed);
+        }
+        if(!ok) {
+            std::cerr << filename << ": compression failed" << std::endl;
+            return false;
+        }
+#else
+        std::cerr << filename << ": .svgz output needs a build with -DLSYSTEM_ZLIB -lz" << std::endl;
+        return false;
+#endif
     }
     
-    LSystem kochCurve() {
-        LSystem ls("F");
-        ls.addRule('F', "F+F-F-F+F");
-        return ls;
+    std::ofstream file(filename, std::ios::binary);
+    for(const std::string& chunk : chunks) {
+        file.write(chunk.data(), chunk.size());
+    }
+    if(!file) {
+        std::cerr << filename << ": write failed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// PNG needs a zlib stream. Without zlib the pixels go into stored
+// (uncompressed) deflate blocks, which every decoder accepts.
+inline uint32_t crc32Update(uint32_t crc, const unsigned char* data, size_t len) {
+    // Built once by a function-local static initializer, which is thread
+    // safe, so concurrent image writes (--batch tasks) can share it.
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t;
+        for(uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for(size_t i = 0; i < len; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline std::string zlibStream(const std::string& raw) {
+#ifdef LSYSTEM_ZLIB
+    uLongf size = compressBound(raw.size());
+    std::string out(size, '\0');
+    compress2((Bytef*)&out[0], &size, (const Bytef*)raw.data(), raw.size(), 6);
+    out.resize(size);
+    return out;
+#else
+    std::string out = "\x78\x01";
+    uint32_t a = 1, b = 0;
+    for(size_t pos = 0; pos < raw.size() || pos == 0; pos += 65535) {
+        uint16_t len = (uint16_t)std::min<size_t>(65535, raw.size() - pos);
+        bool last = pos + len >= raw.size();
+        out += (char)(last ? 1 : 0);
+        out += (char)(len & 0xff);
+        out += (char)(len >> 8);
+        out += (char)(~len & 0xff);
+        out += (char)((uint16_t)~len >> 8);
+        out.append(raw, pos, len);
+        if(last) break;
+    }
+    for(unsigned char c : raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    for(int shift = 24; shift >= 0; shift -= 8) out += (char)((adler >> shift) & 0xff);
+    return out;
+#endif
+}
+
+// Writes 8-bit RGB pixels as .png, or as binary .ppm for any other name.
+inline bool writeImage(const std::string& filename, int width, int height,
+                       const std::vector<unsigned char>& rgb) {
+    std::ofstream file(filename, std::ios::binary);
+    if(!endsWith(filename, ".png")) {
+        file << "P6\n" << width << " " << height << "\n255\n";
+        file.write((const char*)rgb.data(), rgb.size());
+        return (bool)file;
     }
     
-    LSystem plantA() {
-        LSystem ls("F");
-        ls.addRule('F', "F[+F]F[-F]F");
-        return ls;
+    auto chunk = [&](const char* type, const std::string& data) {
+        unsigned char len[4] = {(unsigned char)(data.size() >> 24), (unsigned char)(data.size() >> 16),
+                                (unsigned char)(data.size() >> 8), (unsigned char)data.size()};
+        file.write((const char*)len, 4);
+        file.write(type, 4);
+        file.write(data.data(), data.size());
+        uint32_t crc = crc32Update(0, (const unsigned char*)type, 4);
+        crc = crc32Update(crc, (const unsigned char*)data.data(), data.size());
+        unsigned char c[4] = {(unsigned char)(crc >> 24), (unsigned char)(crc >> 16),
+                              (unsigned char)(crc >> 8), (unsigned char)crc};
+        file.write((const char*)c, 4);
+    };
+    
+    std::string header;
+    for(int v : {width, height}) {
+        for(int shift = 24; shift >= 0; shift -= 8) header += (char)((v >> shift) & 0xff);
     }
+    header += std::string("\x08\x02\x00\x00\x00", 5);  // 8-bit RGB, no interlace
     
-    LSystem plantB() {
-        LSystem ls("F");
-        ls.addRule('F', "FF-[-F+F+F]+[+F-F-F]");
-        return ls;
+    // Every row gets filter type 0 (none).
+    std::string raw;
+    raw.reserve((size_t)height * (width * 3 + 1));
+    for(int y = 0; y < height; y++) {
+        raw += '\0';
+        raw.append((const char*)&rgb[(size_t)y * width * 3], (size_t)width * 3);
     }
     
-    LSystem tree3D() {
-        LSystem ls("A");
-        ls.addRule('A', "!![&FL!A]/////'/[&FL!A]///////[&FL!A]");
-        ls.addRule('F', "S //// F");
-        ls.addRule('S', "F L");
-        ls.addRule('L', "['''^^{-f+f+f-|-f+f+f}]");
-        return ls;
+    file.write("\x89PNG\r\n\x1a\n", 8);
+    chunk("IHDR", header);
+    chunk("IDAT", zlibStream(raw));
+    chunk("IEND", "");
+    return (bool)file;
+}
+
+// Glow as a post-pass: Gaussian blur of the whole image (horizontal then
+// vertical), screened back over the sharp lines.
+inline void addGlow(std::vector<float>& image, int width, int height, float sigma) {
+    const int radius = (int)std::ceil(3 * sigma);
+    std::vector<float> kernel(2 * radius + 1);
+    float sum = 0;
+    for(int k = -radius; k <= radius; k++) {
+        kernel[k + radius] = std::exp(-0.5f * k * k / (sigma * sigma));
+        sum += kernel[k + radius];
     }
+    for(float& k : kernel) k /= sum;
     
-    LSystem hilbertCurve3D() {
-        LSystem ls("A");
-        ls.addRule('A', "B-F+CFC+F-D&F^D-F+&&CFC+F+B//");
-        ls.addRule('B', "A&F^CFB^F^D^^-F-D^|F^B|FC^F^A//");
-        ls.addRule('C', "|D^|F^B-F+C^F^A&&FA&F^C+F+B^F^D//");
-        ls.addRule('D', "|CFB-F+B|FA&F^A&&FB-F+B|FC//");
-        return ls;
+    std::vector<float> horizontal(image.size()), blurred(image.size());
+    #pragma omp parallel for schedule(static)
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            float acc[3] = {0, 0, 0};
+            for(int k = -radius; k <= radius; k++) {
+                int sx = std::min(width - 1, std::max(0, x + k));
+                const float* src = &image[((size_t)y * width + sx) * 3];
+                for(int c = 0; c < 3; c++) acc[c] += src[c] * kernel[k + radius];
+            }
+            for(int c = 0; c < 3; c++) horizontal[((size_t)y * width + x) * 3 + c] = acc[c];
+        }
+    }
+    #pragma omp parallel for schedule(static)
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width; x++) {
+            float acc[3] = {0, 0, 0};
+            for(int k = -radius; k <= radius; k++) {
+                int sy = std::min(height - 1, std::max(0, y + k));
+                const float* src = &horizontal[((size_t)sy * width + x) * 3];
+                for(int c = 0; c < 3; c++) acc[c] += src[c] * kernel[k + radius];
+            }
+            for(int c = 0; c < 3; c++) blurred[((size_t)y * width + x) * 3 + c] = acc[c];
+        }
+    }
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < image.size(); i++) {
+        image[i] = 1.0f - (1.0f - image[i]) * (1.0f - blurred[i]);
     }
 }
 
-
-
-int main() {
+// Read-only structure-of-arrays view of a segment list: the coordinates are
+// separate float arrays, widths and colours are 16-bit indices into small
+// palettes. Backed either by a SegmentStore or by a mapped geometry file.
+struct SegmentView {
+    size_t count = 0;
+    const float *x0 = nullptr, *y0 = nullptr, *z0 = nullptr;
+    const float *x1 = nullptr, *y1 = nullptr, *z1 = nullptr;
+    const uint16_t *widthIndex = nullptr, *colorIndex = nullptr;
+    const float* widths = nullptr;
+    const float* colors = nullptr;   // rgb triples
+    size_t widthCount = 0, colorCount = 0;
+    
+    Line line(size_t i) const {
+        const float* c = colors + 3 * colorIndex[i];
+        return {Vec3(x0[i], y0[i], z0[i]), Vec3(x1[i], y1[i], z1[i]), widths[widthIndex[i]],
+                Vec3(c[0], c[1], c[2])};
+    }
+    
+    // 2D bounding box. Each thread keeps eight running minima/maxima per axis
+    // so the inner loop vectorizes over contiguous SoA lanes.
+    void bounds(Vec3& minB, Vec3& maxB) const {
+        float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+        #pragma omp parallel reduction(min:minX,minY) reduction(max:maxX,maxY)
+        {
+            const int L = 8;
+            float lo[2][L], hi[2][L];
+            for(int l = 0; l < L; l++) {
+                lo[0][l] = lo[1][l] = INFINITY;
+                hi[0][l] = hi[1][l] = -INFINITY;
+            }
+            #pragma omp for schedule(static)
+            for(size_t b = 0; b < count / L; b++) {
+                const size_t i = b * L;
+                for(int l = 0; l < L; l++) {
+                    float ax = x0[i + l], bx = x1[i + l], ay = y0[i + l], by = y1[i + l];
+                    float mx = ax < bx ? ax : bx, Mx = ax < bx ? bx : ax;
+                    float my = ay < by ? ay : by, My = ay < by ? by : ay;
+                    lo[0][l] = mx < lo[0][l] ? mx : lo[0][l];
+                    hi[0][l] = Mx > hi[0][l] ? Mx : hi[0][l];
+                    lo[1][l] = my < lo[1][l] ? my : lo[1][l];
+                    hi[1][l] = My > hi[1][l] ? My : hi[1][l];
+                }
+            }
+            #pragma omp single nowait
+            for(size_t i = count / L * L; i < count; i++) {
+                minX = std::min(minX, std::min(x0[i], x1[i]));
+                minY = std::min(minY, std::min(y0[i], y1[i]));
+                maxX = std::max(maxX, std::max(x0[i], x1[i]));
+                maxY = std::max(maxY, std::max(y0[i], y1[i]));
+            }
+            for(int l = 0; l < L; l++) {
+                minX = std::min(minX, lo[0][l]);
+                minY = std::min(minY, lo[1][l]);
+                maxX = std::max(maxX, hi[0][l]);
+                maxY = std::max(maxY, hi[1][l]);
+            }
+        }
+        minB = Vec3(minX, minY, 0);
+        maxB = Vec3(maxX, maxY, 0);
+    }
+};
+
+// Owning SoA segment storage, 28 bytes per segment instead of 40. Palettes
+// hold up to 65536 distinct widths and colours; past that, new values map to
+// the nearest existing entry.
+class SegmentStore {
+public:
+    std::vector<float> x0, y0, z0, x1, y1, z1;
+    std::vector<uint16_t> widthIndex, colorIndex;
+    std::vector<float> widths, colors;
+    
+    void assign(const std::vector<Line>& lines) {
+        const size_t n = lines.size();
+        for(auto* v : {&x0, &y0, &z0, &x1, &y1, &z1}) v->resize(n);
+        widthIndex.resize(n);
+        colorIndex.resize(n);
+        widths.clear();
+        colors.clear();
+        
+        PaletteSlots<1> widthSlot;
+        PaletteSlots<3> colorSlot;
+        for(size_t i = 0; i < n; i++) {
+            const Line& l = lines[i];
+            x0[i] = l.start.x; y0[i] = l.start.y; z0[i] = l.start.z;
+            x1[i] = l.end.x;   y1[i] = l.end.y;   z1[i] = l.end.z;
+            widthIndex[i] = paletteIndex<1>(widthSlot, widths, &l.width);
+            float rgb[3] = {l.color.x, l.color.y, l.color.z};
+            colorIndex[i] = paletteIndex<3>(colorSlot, colors, rgb);
+        }
+    }
+    
+    SegmentView view() const {
+        SegmentView v;
+        v.count = x0.size();
+        v.x0 = x0.data(); v.y0 = y0.data(); v.z0 = z0.data();
+        v.x1 = x1.data(); v.y1 = y1.data(); v.z1 = z1.data();
+        v.widthIndex = widthIndex.data();
+        v.colorIndex = colorIndex.data();
+        v.widths = widths.data();
+        v.colors = colors.data();
+        v.widthCount = widths.size();
+        v.colorCount = colors.size() / 3;
+        return v;
+    }
+    
+    // Binary geometry file, version 1 (little endian): the header below, then
+    // x0 y0 z0 x1 y1 z1 (float[count] each), width and colour indices
+    // (uint16[count] each), the width palette (float[widthCount]) and the
+    // colour palette (float[3 * colorCount]). Every section starts on an
+    // 8-byte boundary so a mapped file can be used in place.
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t count;
+        uint32_t widthCount, colorCount;
+    };
+    static const uint32_t fileVersion = 1;
+    
+    bool save(const std::string& filename) const {
+        SegmentView v = view();
+        std::ofstream file(filename, std::ios::binary);
+        FileHeader header = {{'L', 'S', 'Y', 'G'}, fileVersion, v.count,
+                             (uint32_t)v.widthCount, (uint32_t)v.colorCount};
+        size_t offset = 0;
+        auto put = [&](const void* data, size_t bytes) {
+            file.write((const char*)data, bytes);
+            offset += bytes;
+            static const char pad[8] = {};
+            file.write(pad, (8 - offset % 8) % 8);
+            offset += (8 - offset % 8) % 8;
+        };
+        put(&header, sizeof(header));
+        for(const float* a : {v.x0, v.y0, v.z0, v.x1, v.y1, v.z1}) put(a, v.count * sizeof(float));
+        put(v.widthIndex, v.count * sizeof(uint16_t));
+        put(v.colorIndex, v.count * sizeof(uint16_t));
+        put(v.widths, v.widthCount * sizeof(float));
+        put(v.colors, v.colorCount * 3 * sizeof(float));
+        return (bool)file;
+    }
+    
+private:
+    // Palette entries are keyed on the exact bits of their components.
+    template<int N>
+    struct BitsHash {
+        size_t operator()(const std::array<uint32_t, N>& bits) const {
+            uint64_t h = 0;
+            for(uint32_t b : bits) h = (h ^ b) * 0x9E3779B97F4A7C15ULL;
+            return (size_t)(h ^ (h >> 32));
+        }
+    };
+    template<int N>
+    using PaletteSlots = std::unordered_map<std::array<uint32_t, N>, uint16_t, BitsHash<N>>;
+    
+    template<int N>
+    static uint16_t paletteIndex(PaletteSlots<N>& slots, std::vector<float>& palette, const float* value) {
+        const int components = N;
+        std::array<uint32_t, N> key;
+        std::memcpy(key.data(), value, sizeof(key));
+        auto found = slots.find(key);
+        if(found != slots.end()) return found->second;
+        
+        size_t entries = palette.size() / components;
+        if(entries < 65536) {
+            palette.insert(palette.end(), value, value + components);
+            slots.emplace(key, (uint16_t)entries);
+            return (uint16_t)entries;
+        }
+        size_t best = 0;
+        float bestDist = INFINITY;
+        for(size_t e = 0; e < entries; e++) {
+            float d = 0;
+            for(int c = 0; c < components; c++) {
+                float diff = palette[e * components + c] - value[c];
+                d += diff * diff;
+            }
+            if(d < bestDist) {
+                bestDist = d;
+                best = e;
+            }
+        }
+        return (uint16_t)best;
+    }
+};
+
+// A geometry file mapped read-only; view() points straight into the mapping.
+class MappedSegments {
+private:
+    void* data = MAP_FAILED;
+    size_t size = 0;
+    SegmentView segments;
+    
+public:
+    MappedSegments() {}
+    MappedSegments(const MappedSegments&) = delete;
+    MappedSegments& operator=(const MappedSegments&) = delete;
+    ~MappedSegments() { close(); }
+    
+    bool open(const std::string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0) {
+            std::cerr << "Cannot open " << filename << std::endl;
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SegmentStore::FileHeader)) {
+            size = st.st_size;
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if(data == MAP_FAILED || !parse()) {
+            std::cerr << filename << ": not a valid version " << SegmentStore::fileVersion
+                      << " geometry file" << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    void close() {
+        if(data != MAP_FAILED) munmap(data, size);
+        data = MAP_FAILED;
+        size = 0;
+        segments = SegmentView();
+    }
+    
+    const SegmentView& view() const { return segments; }
+    
+private:
+    bool parse() {
+        SegmentStore::FileHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if(std::memcmp(header.magic, "LSYG", 4) != 0 || header.version != SegmentStore::fileVersion) {
+            return false;
+        }
+        
+        const char* base = (const char*)data;
+        size_t offset = 0;
+        bool fits = true;
+        auto take = [&](size_t bytes) {
+            const char* p = base + offset;
+            offset += bytes;
+            offset += (8 - offset % 8) % 8;
+            fits = fits && offset <= size;
+            return p;
+        };
+        take(sizeof(header));
+        // Bound the count by the file size first, so the section sizes below
+        // cannot overflow.
+        const size_t perSegment = 6 * sizeof(float) + 2 * sizeof(uint16_t);
+        if(header.count > size / perSegment) return false;
+        const size_t n = header.count;
+        const float** coords[] = {&segments.x0, &segments.y0, &segments.z0,
+                                  &segments.x1, &segments.y1, &segments.z1};
+        for(const float** c : coords) *c = (const float*)take(n * sizeof(float));
+        segments.widthIndex = (const uint16_t*)take(n * sizeof(uint16_t));
+        segments.colorIndex = (const uint16_t*)take(n * sizeof(uint16_t));
+        segments.widths = (const float*)take(header.widthCount * sizeof(float));
+        segments.colors = (const float*)take(header.colorCount * 3 * sizeof(float));
+        segments.count = n;
+        segments.widthCount = header.widthCount;
+        segments.colorCount = header.colorCount;
+        if(!fits) return false;
+        
+        // Every palette index has to point into its palette.
+        const uint16_t *widthIndex = segments.widthIndex, *colorIndex = segments.colorIndex;
+        const size_t widthCount = header.widthCount, colorCount = header.colorCount;
+        size_t bad = 0;
+        #pragma omp parallel for schedule(static) reduction(+:bad)
+        for(size_t i = 0; i < n; i++) {
+            bad += widthIndex[i] >= widthCount || colorIndex[i] >= colorCount;
+        }
+        return bad == 0;
+    }
+};
+
+// Branch stack for the turtle: one contiguous block, sized up front from the
+// grammar's maximum bracket depth (LSystem::predict), so '[' and ']' are a
+// copy and an index bump. States are packed without the colour, which no
+// symbol changes, and with the frame as three vectors rather than a
+// quaternion: rotations here act on subsets of heading/left/up, so the frame
+// is not always orthonormal and a quaternion would change the output. If a
+// string nests deeper than reserved, the block grows.
+class StateArena {
+private:
+    // position, heading, left, up and lineWidth lead TurtleState, so a saved
+    // state is one copy of that prefix.
+    static constexpr size_t packedBytes = offsetof(TurtleState, color);
+    struct Packed { unsigned char bytes[packedBytes]; };
+    std::vector<Packed> slots;
+    size_t top = 0;
+    
+public:
+    void reserve(size_t depth) {
+        if(depth > slots.size()) slots.resize(depth);
+    }
+    
+    void clear() { top = 0; }
+    bool empty() const { return top == 0; }
+    size_t capacity() const { return slots.size(); }
+    
+    void push(const TurtleState& s) {
+        if(top == slots.size()) slots.resize(std::max<size_t>(16, 2 * slots.size()));
+        std::memcpy(slots[top++].bytes, &s, packedBytes);
+    }
+    
+    void pop(TurtleState& s) {
+        std::memcpy(static_cast<void*>(&s), slots[--top].bytes, packedBytes);
+    }
+};
+
+class TurtleRenderer {
+private:
+    std::vector<Line> lines;
+    StateArena stateStack;
+    TurtleState turtle;
+    float angle;
+    float stepSize;
+    float widthFactor;
+    
+    // Rotations for the current angle, so turn symbols don't call cos/sin.
+    Matrix3 rotZPos, rotZNeg, rotXPos, rotXNeg, rotYPos, rotYNeg;
+    
+    // When set, the SVG and image renderers frame [viewMin, viewMax]
+    // instead of the bounds of the segments.
+    bool fixedView = false;
+    Vec3 viewMin, viewMax;
+    
+    // Per-chunk output of interpretParallel().
+    std::vector<std::vector<Line>> chunkLines;
+    
+    // When set, segments go here instead of into `lines`.
+    SegmentSink* sink = nullptr;
+    
+    void updateRotations() {
+        rotZPos = Matrix3::rotationZ(angle);
+        rotZNeg = Matrix3::rotationZ(-angle);
+        rotXPos = Matrix3::rotationX(angle);
+        rotXNeg = Matrix3::rotationX(-angle);
+        rotYPos = Matrix3::rotationY(angle);
+        rotYNeg = Matrix3::rotationY(-angle);
+    }
+    
+public:
+    TurtleRenderer(float ang = 25.0f, float step = 1.0f) 
+        : angle(ang * M_PI / 180.0f), stepSize(step), widthFactor(0.9f) { updateRotations(); }
+    
+    void setAngle(float ang) { angle = ang * M_PI / 180.0f; updateRotations(); }
+    void setStep(float step) { stepSize = step; }
+    void setWidthFactor(float factor) { widthFactor = factor; }
+    void reserveDepth(size_t depth) { stateStack.reserve(depth); }
+    void setView(const Vec3& min, const Vec3& max) { fixedView = true; viewMin = min; viewMax = max; }
+    void clearView() { fixedView = false; }
+    
+    void interpret(const std::string& lstring) {
+        reset();
+        
+        for(char c : lstring) {
+            applySymbol(c);
+        }
+        
+        progress() << "Generated " << lines.size() << " line segments" << std::endl;
+    }
+    
+    // Same segments as interpret(), in the same order, on all cores. The
+    // string is cut into equal chunks. A parallel bracket-matching pass
+    // (a stack per chunk, then a short serial merge of what each chunk left
+    // unmatched) lets one thread walk to every cut while stepping over the
+    // branches that close before it, which gives the exact turtle state and
+    // branch stack at each cut: ']' restores what '[' saved, so a skipped
+    // branch changes nothing. The chunks are then interpreted concurrently
+    // from those states into per-chunk buffers and concatenated in order.
+    // The states at the cuts are not found by composing each chunk's turtle
+    // transform (the linear form interpretMemoized() uses) and scanning
+    // those: a composed rotation rounds differently from the same turns
+    // applied one at a time, so every segment after the first cut would
+    // differ from interpret() in the last bits. Strings without brackets
+    // have nothing to skip, and with one thread available the extra passes
+    // only cost time; both run serially.
+    void interpretParallel(const std::string& lstring) {
+        if(availableThreads() == 1) {
+            interpret(lstring);
+            return;
+        }
+        const size_t n = lstring.size();
+        const char* s = lstring.data();
+        const int chunks = omp_get_max_threads() * 8;
+        
+        std::vector<size_t> openCount(chunks + 1, 0);
+        #pragma omp parallel for schedule(static)
+        for(int k = 0; k < chunks; k++) {
+            size_t count = 0;
+            for(size_t i = n * k / chunks; i < n * (k + 1) / chunks; i++) count += s[i] == '[';
+            openCount[k + 1] = count;
+        }
+        for(int k = 0; k < chunks; k++) openCount[k + 1] += openCount[k];
+        if(openCount[chunks] == 0) {
+            interpret(lstring);
+            return;
+        }
+        reset();
+        
+        // For every '[' in string order: where its ']' is, and how many '['
+        // come before that ']' (the index of the next branch after it).
+        struct Branch {
+            size_t close = SIZE_MAX;
+            size_t after = SIZE_MAX;
+        };
+        std::vector<Branch> branches(openCount[chunks]);
+        std::vector<std::vector<size_t>> unmatchedOpen(chunks);
+        std::vector<std::vector<Branch>> unmatchedClose(chunks);
+        #pragma omp parallel for schedule(static)
+        for(int k = 0; k < chunks; k++) {
+            size_t next = openCount[k];
+            std::vector<size_t>& open = unmatchedOpen[k];
+            for(size_t i = n * k / chunks; i < n * (k + 1) / chunks; i++) {
+                if(s[i] == '[') {
+                    open.push_back(next++);
+                } else if(s[i] == ']') {
+                    if(open.empty()) {
+                        unmatchedClose[k].push_back({i, next});
+                    } else {
+                        branches[open.back()] = {i, next};
+                        open.pop_back();
+                    }
+                }
+            }
+        }
+        // A chunk's unmatched ']' all come before its unmatched '['.
+        std::vector<size_t> pending;
+        for(int k = 0; k < chunks; k++) {
+            for(const Branch& close : unmatchedClose[k]) {
+                if(pending.empty()) continue;
+                branches[pending.back()] = close;
+                pending.pop_back();
+            }
+            pending.insert(pending.end(), unmatchedOpen[k].begin(), unmatchedOpen[k].end());
+        }
+        
+        struct Discard : SegmentSink {
+            void segment(const Line&, const TurtleState&) override {}
+        } discard;
+        TurtleRenderer walker = worker();
+        walker.sink = &discard;
+        std::vector<TurtleState> entryState(chunks);
+        std::vector<StateArena> entryStack(chunks);
+        size_t pos = 0, branch = 0;
+        for(int k = 0; k < chunks; k++) {
+            size_t cut = n * k / chunks;
+            while(pos < cut) {
+                if(s[pos] == '[') {
+                    if(branches[branch].close < cut) {
+                        pos = branches[branch].close + 1;
+                        branch = branches[branch].after;
+                        continue;
+                    }
+                    branch++;
+                }
+                walker.applySymbol(s[pos++]);
+            }
+            entryState[k] = walker.turtle;
+            entryStack[k] = walker.stateStack;
+        }
+        
+        // Chunk buffers are kept between calls, like `lines`, so repeated
+        // interpretation doesn't reallocate them.
+        std::vector<std::vector<Line>>& parts = chunkLines;
+        parts.resize(chunks);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(int k = 0; k < chunks; k++) {
+            TurtleRenderer w = worker();
+            w.lines.swap(parts[k]);
+            w.lines.clear();
+            w.turtle = entryState[k];
+            w.stateStack = entryStack[k];
+            for(size_t i = n * k / chunks; i < n * (k + 1) / chunks; i++) w.applySymbol(s[i]);
+            parts[k].swap(w.lines);
+        }
+        std::vector<size_t> offsets(chunks + 1, 0);
+        for(int k = 0; k < chunks; k++) offsets[k + 1] = offsets[k] + parts[k].size();
+        lines.resize(offsets[chunks]);
+        #pragma omp parallel for schedule(static)
+        for(int k = 0; k < chunks; k++) {
+            std::copy(parts[k].begin(), parts[k].end(), lines.begin() + offsets[k]);
+        }
+        
+        progress() << "Generated " << lines.size() << " line segments" << std::endl;
+    }
+    
+    // Interprets a parametric word. A module's first parameter overrides the
+    // step for F/A/B/f, the angle in degrees for + - & ^ \ /, and sets the
+    // line width for !. Modules without parameters act as in interpret().
+    void interpret(const ModuleString& word) {
+        reset();
+        for(size_t i = 0; i < word.size(); i++) {
+            char c = word.symbols[i];
+            if(word.paramCount(i) == 0) {
+                applySymbol(c);
+                continue;
+            }
+            float p = word.paramsOf(i)[0];
+            float radians = p * (float)M_PI / 180.0f;
+            switch(c) {
+                case 'F': case 'A': case 'B': case 'f': {
+                    float saved = stepSize;
+                    stepSize = p;
+                    applySymbol(c);
+                    stepSize = saved;
+                    break;
+                }
+                case '+': rotateOnce(rotZPos, Matrix3::rotationZ(radians), c); break;
+                case '-': rotateOnce(rotZNeg, Matrix3::rotationZ(-radians), c); break;
+                case '&': rotateOnce(rotXPos, Matrix3::rotationX(radians), c); break;
+                case '^': rotateOnce(rotXNeg, Matrix3::rotationX(-radians), c); break;
+                case '\\': rotateOnce(rotYPos, Matrix3::rotationY(radians), c); break;
+                case '/': rotateOnce(rotYNeg, Matrix3::rotationY(-radians), c); break;
+                case '!': turtle.lineWidth = p; break;
+                default: applySymbol(c); break;
+            }
+        }
+        progress() << "Generated " << lines.size() << " line segments" << std::endl;
+    }
+    
+    // Expands and interprets in one pass: symbols come straight from the
+    // stream and segments go straight to the sink, so neither the expanded
+    // string nor the segment list is ever held in memory.
+    size_t interpretStream(SymbolStream& stream, SegmentSink& out) {
+        reset();
+        sink = &out;
+        
+        char buffer[4096];
+        size_t symbols = 0;
+        while(size_t n = stream.read(buffer, sizeof(buffer))) {
+            for(size_t i = 0; i < n; i++) {
+                applySymbol(buffer[i]);
+            }
+            symbols += n;
+        }
+        
+        sink = nullptr;
+        return symbols;
+    }
+    
+    void applySymbol(char c) {
+        switch(c) {
+            case 'F': case 'A': case 'B':
+                // Draw forward
+                drawForward();
+                break;
+                
+            case 'f':
+                // Move forward without drawing
+                moveForward();
+                break;
+                
+            case '+':
+                // Turn left around up axis
+                turnLeft();
+                break;
+                
+            case '-':
+                // Turn right around up axis
+                turnRight();
+                break;
+                
+            case '&':
+                // Pitch down around left axis
+                pitchDown();
+                break;
+                
+            case '^':
+                // Pitch up around left axis
+                pitchUp();
+                break;
+                
+            case '\\':
+                // Roll left around heading axis
+                rollLeft();
+                break;
+                
+            case '/':
+                // Roll right around heading axis
+                rollRight();
+                break;
+                
+            case '|':
+                // Turn around 180 degrees
+                turnAround();
+                break;
+                
+            case '[':
+                // Push state
+                stateStack.push(turtle);
+                turtle.lineWidth *= widthFactor;
+                break;
+                
+            case ']':
+                // Pop state
+                if(!stateStack.empty()) stateStack.pop(turtle);
+                break;
+                
+            case '!':
+                // Decrease line width
+                turtle.lineWidth *= 0.7f;
+                break;
+                
+            case '<':
+                // Multiply line width
+                turtle.lineWidth *= 1.4f;
+                break;
+                
+            case '>':
+                // Divide line width
+                turtle.lineWidth *= 0.7f;
+                break;
+                
+            default:
+                // Ignore unknown symbols
+                break;
+        }
+    }
+    
+    TurtleProgram compile(const std::string& lstring) const {
+        TurtleProgram prog;
+        prog.symbols = lstring.size();
+        
+        // Dense opcode table for the turtle alphabet.
+        TurtleOp opcode[256];
+        for(int i = 0; i < 256; i++) opcode[i] = TurtleOp::None;
+        opcode['F'] = opcode['A'] = opcode['B'] = TurtleOp::Draw;
+        opcode['f'] = TurtleOp::Move;
+        for(char c : std::string("+-&^\\/|")) opcode[(unsigned char)c] = TurtleOp::Rotate;
+        opcode['['] = TurtleOp::Push;
+        opcode[']'] = TurtleOp::Pop;
+        opcode['!'] = opcode['<'] = opcode['>'] = TurtleOp::Scale;
+        
+        Matrix3 flip;
+        flip.m[0][0] = flip.m[1][1] = flip.m[2][2] = -1.0f;
+        std::unordered_map<std::string, uint32_t> runIndex;
+        
+        for(size_t i = 0; i < lstring.size(); ) {
+            unsigned char c = lstring[i];
+            TurtleOp op = opcode[c];
+            if(op == TurtleOp::None) {
+                i++;
+                continue;
+            }
+            TurtleInstr instr = {op, 0, 0.0f};
+            switch(op) {
+                case TurtleOp::Draw:
+                    while(i < lstring.size() && opcode[(unsigned char)lstring[i]] == TurtleOp::Draw) {
+                        instr.index++;
+                        i++;
+                    }
+                    break;
+                case TurtleOp::Move:
+                    while(i < lstring.size() && lstring[i] == 'f') {
+                        instr.value += stepSize;
+                        i++;
+                    }
+                    break;
+                case TurtleOp::Scale:
+                    instr.value = 1.0f;
+                    while(i < lstring.size() && opcode[(unsigned char)lstring[i]] == TurtleOp::Scale) {
+                        instr.value *= (lstring[i] == '<') ? 1.4f : 0.7f;
+                        i++;
+                    }
+                    break;
+                case TurtleOp::Rotate: {
+                    size_t start = i;
+                    while(i < lstring.size() && opcode[(unsigned char)lstring[i]] == TurtleOp::Rotate) i++;
+                    
+                    // Identical runs share one folded rotation.
+                    std::string run = lstring.substr(start, i - start);
+                    auto known = runIndex.find(run);
+                    if(known != runIndex.end()) {
+                        instr.index = known->second;
+                        break;
+                    }
+                    TurtleRotation rot;
+                    for(char t : run) {
+                        switch(t) {
+                            case '+': rot.heading = rotZPos * rot.heading; rot.left = rotZPos * rot.left; rot.touched |= 3; break;
+                            case '-': rot.heading = rotZNeg * rot.heading; rot.left = rotZNeg * rot.left; rot.touched |= 3; break;
+                            case '&': rot.heading = rotXPos * rot.heading; rot.up = rotXPos * rot.up; rot.touched |= 5; break;
+                            case '^': rot.heading = rotXNeg * rot.heading; rot.up = rotXNeg * rot.up; rot.touched |= 5; break;
+                            case '\\': rot.left = rotYPos * rot.left; rot.up = rotYPos * rot.up; rot.touched |= 6; break;
+                            case '/': rot.left = rotYNeg * rot.left; rot.up = rotYNeg * rot.up; rot.touched |= 6; break;
+                            case '|': rot.heading = flip * rot.heading; rot.left = flip * rot.left; rot.touched |= 3; break;
+                        }
+                    }
+                    instr.index = prog.rotations.size();
+                    runIndex.emplace(run, instr.index);
+                    prog.rotations.push_back(rot);
+                    break;
+                }
+                default:
+                    i++;
+                    break;
+            }
+            prog.code.push_back(instr);
+        }
+        return prog;
+    }
+    
+    void interpret(const TurtleProgram& prog) {
+        reset();
+        
+        for(const TurtleInstr& instr : prog.code) {
+            switch(instr.op) {
+                case TurtleOp::Draw:
+                    for(uint32_t k = 0; k < instr.index; k++) drawForward();
+                    break;
+                case TurtleOp::Move:
+                    turtle.position = turtle.position + turtle.heading * instr.value;
+                    break;
+                case TurtleOp::Rotate: {
+                    const TurtleRotation& rot = prog.rotations[instr.index];
+                    if(rot.touched & 1) turtle.heading = rot.heading * turtle.heading;
+                    if(rot.touched & 2) turtle.left = rot.left * turtle.left;
+                    if(rot.touched & 4) turtle.up = rot.up * turtle.up;
+                    break;
+                }
+                case TurtleOp::Push:
+                    stateStack.push(turtle);
+                    turtle.lineWidth *= widthFactor;
+                    break;
+                case TurtleOp::Pop:
+                    if(!stateStack.empty()) stateStack.pop(turtle);
+                    break;
+                case TurtleOp::Scale:
+                    turtle.lineWidth *= instr.value;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    
+    // Interprets generation N through a geometry cache keyed by (symbol,
+    // remaining depth). In this turtle every rotation acts on the heading,
+    // left and up vectors separately, and positions depend only on the
+    // heading, so a sub-derivation's effect is linear in the state it starts
+    // from: position = p0 + S * h0, heading = H * h0, and so on. Each distinct
+    // subtree is therefore interpreted once into relative matrices and then
+    // instanced wherever it occurs. Cost is O(distinct subtrees) to build
+    // plus O(output) to emit. Falls back to streaming interpretation when a
+    // rule has unbalanced brackets.
+    void interpretMemoized(const LSystem& ls, int generations) {
+        reset();
+        memoRules.assign(256, nullptr);
+        for(const auto& rule : ls.getRules()) {
+            memoRules[(unsigned char)rule.first] = &rule.second;
+        }
+        memoGrown = nullptr;
+        memoIndex.clear();
+        memo.clear();
+        
+        SubtreeGeometry root;
+        if(!buildSubtree(ls.getAxiom(), generations, root)) {
+            progress() << "Unbalanced brackets, interpreting without the cache" << std::endl;
+            SymbolStream stream(ls, generations);
+            char c;
+            while(stream.next(c)) applySymbol(c);
+        } else {
+            TurtleState start = turtle;
+            emitSubtree(root, start);
+        }
+        progress() << "Generated " << lines.size() << " line segments (" << memo.size()
+                   << " distinct subtrees)" << std::endl;
+    }
+    
+    // Prepares the subtree cache for interpretGrowth(). `grown` holds, for
+    // every rule symbol, one flag per successor symbol: steps flagged there
+    // are new growth when that rule is the last one applied. The cache
+    // lives until the next beginGrowth() or interpretMemoized(), so each
+    // generation reuses the subtrees of the ones before it.
+    void beginGrowth(const LSystem& ls, const std::vector<uint8_t>* grown) {
+        memoRules.assign(256, nullptr);
+        for(const auto& rule : ls.getRules()) {
+            memoRules[(unsigned char)rule.first] = &rule.second;
+        }
+        memoGrown = grown;
+        memoIndex.clear();
+        memo.clear();
+    }
+    
+    // Generation N of `axiom` with its new growth at zero length in `from`
+    // and at full length in `to`. The two lists line up one to one, so any
+    // growth in between is a linear blend of them. Returns false on
+    // unbalanced brackets.
+    bool interpretGrowth(const std::string& axiom, int generations,
+                         std::vector<Line>& from, std::vector<Line>& to) {
+        reset();
+        SubtreeGeometry root;
+        if(!buildSubtree(axiom, generations, root)) return false;
+        from.clear();
+        to.clear();
+        from.reserve(root.segments);
+        to.reserve(root.segments);
+        emitGrowing(root, turtle, turtle.position, turtle.position, noLine, from, to);
+        return true;
+    }
+    
+    size_t segmentCount() const { return lines.size(); }
+    const std::vector<Line>& getLines() const { return lines; }
+    void swapLines(std::vector<Line>& other) { lines.swap(other); }
+
+    
+    // Level of detail for rendering at `scale` pixels per unit: segments are
+    // clipped to the view rectangle [viewMin, viewMax] (x/y only), their ends
+    // snapped to a uniform grid of one pixel per cell, and segments that
+    // snap to the same cells are merged into one (widest wins). Sub-pixel
+    // segments collapse to a single cell; they are kept as one-pixel dots
+    // unless a longer segment starts or ends in that cell (cells a longer
+    // segment only passes through are not checked, so a dot can still sit
+    // under one). What remains is bounded by the view's pixel count, not by
+    // the number of symbols.
+    // Returns the number of segments removed. Snapped segments keep a 32-bit
+    // index, so past UINT32_MAX segments the list is left as it was.
+    size_t simplify(float scale, const Vec3& viewMin, const Vec3& viewMax) {
+        struct Snapped {
+            int32_t x0, y0, x1, y1;
+            uint32_t index;
+            bool operator<(const Snapped& o) const {
+                if(x0 != o.x0) return x0 < o.x0;
+                if(y0 != o.y0) return y0 < o.y0;
+                if(x1 != o.x1) return x1 < o.x1;
+                if(y1 != o.y1) return y1 < o.y1;
+                return index < o.index;
+            }
+            bool sameCells(const Snapped& o) const {
+                return x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1;
+            }
+            bool dot() const { return x0 == x1 && y0 == y1; }
+        };
+        auto cellKey = [](int32_t x, int32_t y) { return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y; };
+        
+        const size_t n = lines.size();
+        if(n > UINT32_MAX) {
+            std::cerr << n << " segments: simplifying supports at most " << UINT32_MAX << std::endl;
+            return 0;
+        }
+        std::vector<Snapped> snapped(n);
+        std::vector<char> inside(n);
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < n; i++) {
+            // Liang-Barsky clip against the view rectangle.
+            const Line& l = lines[i];
+            float dx = l.end.x - l.start.x, dy = l.end.y - l.start.y;
+            float p[4] = {-dx, dx, -dy, dy};
+            float q[4] = {l.start.x - viewMin.x, viewMax.x - l.start.x,
+                          l.start.y - viewMin.y, viewMax.y - l.start.y};
+            float t0 = 0.0f, t1 = 1.0f;
+            bool visible = true;
+            for(int k = 0; k < 4 && visible; k++) {
+                if(p[k] == 0.0f) {
+                    visible = q[k] >= 0.0f;
+                } else if(p[k] < 0.0f) {
+                    t0 = std::max(t0, q[k] / p[k]);
+                } else {
+                    t1 = std::min(t1, q[k] / p[k]);
+                }
+                visible = visible && t0 <= t1;
+            }
+            inside[i] = visible;
+            if(!visible) continue;
+            
+            auto cell = [](float v) { return (int32_t)std::floor(v + 0.5f); };
+            int32_t ax = cell((l.start.x + t0 * dx - viewMin.x) * scale);
+            int32_t ay = cell((l.start.y + t0 * dy - viewMin.y) * scale);
+            int32_t bx = cell((l.start.x + t1 * dx - viewMin.x) * scale);
+            int32_t by = cell((l.start.y + t1 * dy - viewMin.y) * scale);
+            // Direction doesn't matter for drawing, so reversed duplicates merge too.
+            if(cellKey(bx, by) < cellKey(ax, ay)) {
+                std::swap(ax, bx);
+                std::swap(ay, by);
+            }
+            snapped[i] = {ax, ay, bx, by, (uint32_t)i};
+        }
+        
+        // Bucket the visible segments by their first grid column (a counting
+        // sort with per-thread counts, stable in list order), then sort each
+        // column in parallel; equal snapped segments end up adjacent.
+        const int columns = (int)std::ceil((viewMax.x - viewMin.x) * scale) + 2;
+        const int threads = omp_get_max_threads();
+        std::vector<size_t> counts((size_t)threads * columns + 1, 0);
+        #pragma omp parallel num_threads(threads)
+        {
+            size_t* local = &counts[(size_t)omp_get_thread_num() * columns];
+            #pragma omp for schedule(static)
+            for(size_t i = 0; i < n; i++) {
+                if(inside[i]) local[std::min(columns - 1, std::max(0, snapped[i].x0))]++;
+            }
+        }
+        // Offsets ordered by column first, then thread, so the scatter is stable.
+        std::vector<size_t> offsets((size_t)threads * columns), columnStart(columns + 1);
+        size_t total = 0;
+        for(int c = 0; c < columns; c++) {
+            columnStart[c] = total;
+            for(int t = 0; t < threads; t++) {
+                offsets[(size_t)t * columns + c] = total;
+                total += counts[(size_t)t * columns + c];
+            }
+        }
+        columnStart[columns] = total;
+        std::vector<Snapped> visible(total);
+        #pragma omp parallel num_threads(threads)
+        {
+            size_t* next = &offsets[(size_t)omp_get_thread_num() * columns];
+            #pragma omp for schedule(static)
+            for(size_t i = 0; i < n; i++) {
+                if(inside[i]) visible[next[std::min(columns - 1, std::max(0, snapped[i].x0))]++] = snapped[i];
+            }
+        }
+        #pragma omp parallel for schedule(dynamic, 16)
+        for(int c = 0; c < columns; c++) {
+            std::sort(visible.begin() + columnStart[c], visible.begin() + columnStart[c + 1]);
+        }
+        
+        // Cells touched by real segments; dots there add nothing.
+        std::vector<uint64_t> covered;
+        for(const Snapped& s : visible) {
+            if(!s.dot()) {
+                covered.push_back(cellKey(s.x0, s.y0));
+                covered.push_back(cellKey(s.x1, s.y1));
+            }
+        }
+        std::sort(covered.begin(), covered.end());
+        
+        const float pixel = 1.0f / scale;
+        std::vector<Line> reduced;
+        for(size_t g = 0; g < visible.size();) {
+            size_t end = g + 1;
+            float width = lines[visible[g].index].width;
+            while(end < visible.size() && visible[end].sameCells(visible[g])) {
+                width = std::max(width, lines[visible[end].index].width);
+                end++;
+            }
+            const Snapped& s = visible[g];
+            if(!s.dot() || !std::binary_search(covered.begin(), covered.end(), cellKey(s.x0, s.y0))) {
+                Line line = lines[s.index];
+                line.start = Vec3(viewMin.x + s.x0 * pixel, viewMin.y + s.y0 * pixel, line.start.z);
+                line.end = Vec3(viewMin.x + (s.x1 + (s.dot() ? 1 : 0)) * pixel,
+                                viewMin.y + s.y1 * pixel, line.end.z);
+                line.width = width;
+                reduced.push_back(line);
+            }
+            g = end;
+        }
+        
+        size_t removed = n - reduced.size();
+        lines.swap(reduced);
+        return removed;
+    }
+    
+    // Replaces the segments with their projection through `camera`, sorted
+    // back to front, so the SVG and image renderers (which draw in list
+    // order) get occlusion right. Screen x/y go into x/y and the depth into
+    // z. The camera looks at the centre of the 3D bounds; in perspective it
+    // stands far enough back to see them all, and sizes at the centre's
+    // depth match the orthographic view. Depth is quantized to 16 bits for a
+    // parallel radix sort; ties keep drawing order. Colours darken and, in
+    // perspective, widths shrink with distance. Returns false, leaving the
+    // segments as they were, past the sort's UINT32_MAX segments.
+    bool projectLines(const Camera& camera) {
+        const size_t n = lines.size();
+        if(n == 0) return true;
+        if(n > UINT32_MAX) {
+            std::cerr << n << " segments: depth sorting supports at most " << UINT32_MAX << std::endl;
+            return false;
+        }
+        
+        float minX = lines[0].start.x, minY = lines[0].start.y, minZ = lines[0].start.z;
+        float maxX = minX, maxY = minY, maxZ = minZ;
+        #pragma omp parallel for schedule(static) reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+        for(size_t i = 0; i < n; i++) {
+            const Line& l = lines[i];
+            minX = std::min(minX, std::min(l.start.x, l.end.x));
+            minY = std::min(minY, std::min(l.start.y, l.end.y));
+            minZ = std::min(minZ, std::min(l.start.z, l.end.z));
+            maxX = std::max(maxX, std::max(l.start.x, l.end.x));
+            maxY = std::max(maxY, std::max(l.start.y, l.end.y));
+            maxZ = std::max(maxZ, std::max(l.start.z, l.end.z));
+        }
+        const Vec3 center((minX + maxX) / 2, (minY + maxY) / 2, (minZ + maxZ) / 2);
+        const float radius = std::max(1e-6f, (Vec3(maxX, maxY, maxZ) - center).length());
+        
+        Vec3 forward = camera.direction.normalize();
+        if(forward.length() == 0) forward = Vec3(0, 0, -1);
+        Vec3 upHint = std::fabs(forward.y) > 0.99f ? Vec3(0, 0, 1) : Vec3(0, 1, 0);
+        const Vec3 right = forward.cross(upHint).normalize();
+        const Vec3 up = right.cross(forward);
+        const float distance = camera.perspective
+            ? radius / std::tan(camera.fov * (float)M_PI / 360.0f) + radius : radius;
+        const Vec3 eye = center - forward * distance;
+        
+        auto project = [&](const Vec3& p, float& depth) {
+            Vec3 rel = p - eye;
+            depth = rel.dot(forward);
+            float f = camera.perspective ? distance / std::max(depth, 1e-3f * radius) : 1.0f;
+            return Vec3(rel.dot(right) * f, rel.dot(up) * f, depth);
+        };
+        
+        // Depths lie within [distance - radius, distance + radius].
+        const float nearest = distance - radius, span = 2 * radius;
+        std::vector<uint64_t> order(n);
+        std::vector<Line> projected(n);
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < n; i++) {
+            const Line& l = lines[i];
+            float d0, d1;
+            Line p = l;
+            p.start = project(l.start, d0);
+            p.end = project(l.end, d1);
+            float depth = (d0 + d1) / 2;
+            float q = std::min(1.0f, std::max(0.0f, (depth - nearest) / span));
+            float shade = 1.0f - 0.65f * q;
+            p.color = l.color * shade;
+            if(camera.perspective) p.width = l.width * distance / std::max(depth, 1e-3f * radius);
+            // The writers draw plain strokes at half the width, unclamped;
+            // keep thin and distant branches at least the 0.5 stroke the
+            // light style uses, so they stay visible.
+            p.width = std::max(1.0f, p.width);
+            projected[i] = p;
+            // Farthest first.
+            order[i] = ((uint64_t)(uint16_t)((1.0f - q) * 65535.0f) << 32) | (uint32_t)i;
+        }
+        radixSortKeys16(order);
+        
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < n; i++) lines[i] = projected[(uint32_t)order[i]];
+        return true;
+    }
+    
+    // Copies the segment list into SoA storage, e.g. to save it with
+    // SegmentStore::save().
+    void storeLines(SegmentStore& store) const { store.assign(lines); }
+    
+    // Replaces the segment list with previously stored geometry, so the
+    // renderers can run without expanding or interpreting anything.
+    void loadLines(const SegmentView& segments) {
+        reset();
+        lines.resize(segments.count);
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < segments.count; i++) lines[i] = segments.line(i);
+    }
+    
+private:
+    // A segment or a sub-derivation inside a cached subtree, stored relative
+    // to the state the subtree starts in. With growth flags (see
+    // beginGrowth()), steps of new growth are kept apart in `grown`: at
+    // growth t the start position is p0 + (offset + t * grown) * h0.
+    // `source` says where the turtle was before the item in terms of the
+    // subtree itself: the end of item k (k >= 0), the subtree's start (-1),
+    // or neither, after an f (-2). Composed offsets round differently from
+    // the turtle's running sum, so emitGrowing() takes such starts from the
+    // segment that really ends there; connected segments then meet exactly,
+    // as the polyline writers expect.
+    struct SubtreeItem {
+        int child;                    // memo index, or -1 for a segment (-2: new growth)
+        int source;
+        float width;                  // width multiplier
+        Matrix3 offset;               // start position = p0 + offset * h0
+        Matrix3 grown;
+        Matrix3 heading, left, up;    // vector = M * vector0
+    };
+    
+    struct SubtreeGeometry {
+        std::vector<SubtreeItem> items;
+        size_t segments = 0;
+        Matrix3 offset, grown, heading, left, up;   // net effect on the turtle
+        float width = 1.0f;
+        int endSource = -1;                         // where the turtle ends, as SubtreeItem::source
+    };
+    
+    // Subtrees with at most this many segments are stored flattened, without
+    // child references.
+    static const size_t flattenLimit = 256;
+    static const size_t noLine = SIZE_MAX;
+    
+    std::vector<const std::string*> memoRules;
+    const std::vector<uint8_t>* memoGrown = nullptr;   // per rule, per successor symbol
+    std::unordered_map<uint64_t, int> memoIndex;
+    std::vector<SubtreeGeometry> memo;
+    
+    int subtreeFor(char symbol, int depth) {
+        uint64_t key = ((uint64_t)depth << 8) | (unsigned char)symbol;
+        auto found = memoIndex.find(key);
+        if(found != memoIndex.end()) return found->second;
+        
+        SubtreeGeometry geom;
+        const std::vector<uint8_t>* flags = (memoGrown && depth == 1) ? &memoGrown[(unsigned char)symbol] : nullptr;
+        if(!buildSubtree(*memoRules[(unsigned char)symbol], depth - 1, geom, flags)) return -1;
+        memo.push_back(std::move(geom));
+        memoIndex[key] = memo.size() - 1;
+        return memo.size() - 1;
+    }
+    
+    // Interprets `body`, whose symbols each still expand `depth` more times,
+    // into relative geometry. Steps of the symbols flagged in `grown` count
+    // as new growth. Returns false on unbalanced brackets.
+    bool buildSubtree(const std::string& body, int depth, SubtreeGeometry& out,
+                      const std::vector<uint8_t>* grown = nullptr) {
+        struct RelState {
+            Matrix3 offset, grown, heading, left, up;
+            float width;
+            int source;
+        };
+        Matrix3 zero;
+        zero.m[0][0] = zero.m[1][1] = zero.m[2][2] = 0.0f;
+        Matrix3 flip;
+        flip.m[0][0] = flip.m[1][1] = flip.m[2][2] = -1.0f;
+        
+        RelState st = {zero, zero, Matrix3(), Matrix3(), Matrix3(), 1.0f, -1};
+        std::vector<RelState> stack;
+        
+        auto addScaled = [](Matrix3& a, const Matrix3& b, float s) {
+            for(int i = 0; i < 3; i++)
+                for(int j = 0; j < 3; j++)
+                    a.m[i][j] += b.m[i][j] * s;
+        };
+        
+        for(size_t i = 0; i < body.size(); i++) {
+            const char c = body[i];
+            const bool growing = grown && (*grown)[i];
+            if(depth > 0 && memoRules[(unsigned char)c]) {
+                int idx = subtreeFor(c, depth);
+                if(idx < 0) return false;
+                const SubtreeGeometry& child = memo[idx];
+                if(child.segments <= flattenLimit) {
+                    // Inline the child's items composed with the current state.
+                    const int base = out.items.size();
+                    auto rebase = [&](int source) { return source >= 0 ? base + source : source == -1 ? st.source : -2; };
+                    for(const SubtreeItem& item : child.items) {
+                        SubtreeItem composed = {item.child, rebase(item.source), st.width * item.width,
+                                                st.offset, st.grown, item.heading * st.heading,
+                                                item.left * st.left, item.up * st.up};
+                        addScaled(composed.offset, item.offset * st.heading, 1.0f);
+                        addScaled(composed.grown, item.grown * st.heading, 1.0f);
+                        out.items.push_back(composed);
+                    }
+                    st.source = rebase(child.endSource);
+                } else {
+                    out.items.push_back({idx, st.source, st.width, st.offset, st.grown, st.heading, st.left, st.up});
+                    st.source = out.items.size() - 1;
+                }
+                out.segments += child.segments;
+                addScaled(st.offset, child.offset * st.heading, 1.0f);
+                addScaled(st.grown, child.grown * st.heading, 1.0f);
+                st.heading = child.heading * st.heading;
+                st.left = child.left * st.left;
+                st.up = child.up * st.up;
+                st.width *= child.width;
+                continue;
+            }
+            switch(c) {
+                case 'F': case 'A': case 'B':
+                    out.items.push_back({growing ? -2 : -1, st.source, st.width, st.offset, st.grown,
+                                         st.heading, st.left, st.up});
+                    out.segments++;
+                    addScaled(growing ? st.grown : st.offset, st.heading, stepSize);
+                    st.source = out.items.size() - 1;
+                    break;
+                case 'f':
+                    addScaled(growing ? st.grown : st.offset, st.heading, stepSize);
+                    st.source = -2;
+                    break;
+                case '+': st.heading = rotZPos * st.heading; st.left = rotZPos * st.left; break;
+                case '-': st.heading = rotZNeg * st.heading; st.left = rotZNeg * st.left; break;
+                case '&': st.heading = rotXPos * st.heading; st.up = rotXPos * st.up; break;
+                case '^': st.heading = rotXNeg * st.heading; st.up = rotXNeg * st.up; break;
+                case '\\': st.left = rotYPos * st.left; st.up = rotYPos * st.up; break;
+                case '/': st.left = rotYNeg * st.left; st.up = rotYNeg * st.up; break;
+                case '|': st.heading = flip * st.heading; st.left = flip * st.left; break;
+                case '[':
+                    stack.push_back(st);
+                    st.width *= widthFactor;
+                    break;
+                case ']':
+                    if(stack.empty()) return false;
+                    st = stack.back();
+                    stack.pop_back();
+                    break;
+                case '!': case '>': st.width *= 0.7f; break;
+                case '<': st.width *= 1.4f; break;
+                default: break;
+            }
+        }
+        if(!stack.empty()) return false;
+        
+        out.offset = st.offset;
+        out.grown = st.grown;
+        out.heading = st.heading;
+        out.left = st.left;
+        out.up = st.up;
+        out.width = st.width;
+        out.endSource = st.source;
+        return true;
+    }
+    
+    void emitSubtree(const SubtreeGeometry& geom, const TurtleState& base) {
+        for(const SubtreeItem& item : geom.items) {
+            turtle.position = base.position + item.offset * base.heading;
+            turtle.heading = item.heading * base.heading;
+            turtle.lineWidth = base.lineWidth * item.width;
+            if(item.child < 0) {
+                if(sink) {
+                    turtle.left = item.left * base.left;
+                    turtle.up = item.up * base.up;
+                }
+                drawForward();
+            } else {
+                turtle.left = item.left * base.left;
+                turtle.up = item.up * base.up;
+                TurtleState childBase = turtle;
+                emitSubtree(memo[item.child], childBase);
+            }
+        }
+    }
+    
+    // emitSubtree() for growth: every segment goes to `from` at growth 0 and
+    // to `to` at growth 1. Both share the turtle frame in `base` and differ
+    // only in where the subtree starts; `startLine` is the segment that ends
+    // there, if any. Returns the segment that ends where the subtree ends,
+    // or noLine.
+    size_t emitGrowing(const SubtreeGeometry& geom, const TurtleState& base, const Vec3& start0,
+                       const Vec3& start1, size_t startLine, std::vector<Line>& from, std::vector<Line>& to) const {
+        std::vector<size_t> ends(geom.items.size());
+        auto lineAt = [&](int source) { return source >= 0 ? ends[source] : source == -1 ? startLine : noLine; };
+        for(size_t k = 0; k < geom.items.size(); k++) {
+            const SubtreeItem& item = geom.items[k];
+            const size_t line = lineAt(item.source);
+            Vec3 p0 = start0 + item.offset * base.heading;
+            Vec3 p1 = start1 + item.offset * base.heading + item.grown * base.heading;
+            if(line != noLine) {
+                p0 = from[line].end;
+                p1 = to[line].end;
+            }
+            Vec3 heading = item.heading * base.heading;
+            float width = base.lineWidth * item.width;
+            if(item.child < 0) {
+                Vec3 step = heading * stepSize;
+                from.push_back({p0, item.child == -2 ? p0 : p0 + step, width, base.color});
+                to.push_back({p1, p1 + step, width, base.color});
+                ends[k] = to.size() - 1;
+            } else {
+                TurtleState childBase = base;
+                childBase.heading = heading;
+                childBase.left = item.left * base.left;
+                childBase.up = item.up * base.up;
+                childBase.lineWidth = width;
+                ends[k] = emitGrowing(memo[item.child], childBase, p0, p1, line, from, to);
+            }
+        }
+        return lineAt(geom.endSource);
+    }
+    
+    void frameBounds(Vec3& minBounds, Vec3& maxBounds) const {
+        if(fixedView) {
+            minBounds = viewMin;
+            maxBounds = viewMax;
+        } else {
+            lineBounds(lines, minBounds, maxBounds);
+        }
+    }
+    
+    // An empty renderer with the same angle, step and width factor.
+    TurtleRenderer worker() const {
+        TurtleRenderer w(0.0f, stepSize);
+        w.angle = angle;
+        w.widthFactor = widthFactor;
+        w.updateRotations();
+        return w;
+    }
+    
+    // Applies symbol c with `rot` temporarily standing in for its rotation.
+    void rotateOnce(Matrix3& slot, const Matrix3& rot, char c) {
+        Matrix3 saved = slot;
+        slot = rot;
+        applySymbol(c);
+        slot = saved;
+    }
+    
+    void reset() {
+        lines.clear();
+        stateStack.clear();
+        
+        turtle = TurtleState();
+    }
+    
+    void drawForward() {
+        Vec3 newPos = turtle.position + turtle.heading * stepSize;
+        Line line = {turtle.position, newPos, turtle.lineWidth, turtle.color};
+        if(sink) {
+            sink->segment(line, turtle);
+        } else {
+            lines.push_back(line);
+        }
+        turtle.position = newPos;
+    }
+    
+    void moveForward() {
+        turtle.position = turtle.position + turtle.heading * stepSize;
+    }
+    
+    void turnLeft() {
+        const Matrix3& rot = rotZPos;
+        turtle.heading = rot * turtle.heading;
+        turtle.left = rot * turtle.left;
+    }
+    
+    void turnRight() {
+        const Matrix3& rot = rotZNeg;
+        turtle.heading = rot * turtle.heading;
+        turtle.left = rot * turtle.left;
+    }
+    
+    void pitchDown() {
+        const Matrix3& rot = rotXPos;
+        turtle.heading = rot * turtle.heading;
+        turtle.up = rot * turtle.up;
+    }
+    
+    void pitchUp() {
+        const Matrix3& rot = rotXNeg;
+        turtle.heading = rot * turtle.heading;
+        turtle.up = rot * turtle.up;
+    }
+    
+    void rollLeft() {
+        const Matrix3& rot = rotYPos;
+        turtle.left = rot * turtle.left;
+        turtle.up = rot * turtle.up;
+    }
+    
+    void rollRight() {
+        const Matrix3& rot = rotYNeg;
+        turtle.left = rot * turtle.left;
+        turtle.up = rot * turtle.up;
+    }
+    
+    void turnAround() {
+        turtle.heading = turtle.heading * -1.0f;
+        turtle.left = turtle.left * -1.0f;
+    }
+    
+public:
+
+    void renderToSVGEnhanced(const std::string& filename, float scale = 10.0f, 
+                            const std::string& style = "gradient") {
+        if(lines.empty()) return;
+        
+        // Find bounding box
+        Vec3 minBounds = lines[0].start;
+        Vec3 maxBounds = lines[0].start;
+        
+        for(const Line& line : lines) {
+            minBounds.x = std::min(minBounds.x, std::min(line.start.x, line.end.x));
+            minBounds.y = std::min(minBounds.y, std::min(line.start.y, line.end.y));
+            maxBounds.x = std::max(maxBounds.x, std::max(line.start.x, line.end.x));
+            maxBounds.y = std::max(maxBounds.y, std::max(line.start.y, line.end.y));
+        }
+        
+        float width = (maxBounds.x - minBounds.x) * scale + 200;
+        float height = (maxBounds.y - minBounds.y) * scale + 200;
+        
+        std::ofstream file(filename);
+        file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+        file << "<svg width=\"" << width << "\" height=\"" << height << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+        
+        // Enhanced background with gradient
+        file << "<defs>\n";
+        
+        if(style == "gradient" || style == "rainbow") {
+            // Background gradient
+            file << "<radialGradient id=\"bg\" cx=\"50%\" cy=\"50%\" r=\"50%\">\n";
+            file << "<stop offset=\"0%\" style=\"stop-color:#001122;stop-opacity:1\" />\n";
+            file << "<stop offset=\"100%\" style=\"stop-color:#000000;stop-opacity:1\" />\n";
+            file << "</radialGradient>\n";
+            
+            // Line gradients for depth effect
+            for(int i = 0; i < std::min((int)lines.size(), 10); i++) {
+                file << "<linearGradient id=\"lineGrad" << i << "\" x1=\"0%\" y1=\"0%\" x2=\"100%\" y2=\"100%\">\n";
+                
+                if(style == "rainbow") {
+                    float hue1 = std::fmod(i * 137.5f, 360.0f);
+                    float hue2 = std::fmod(hue1 + 60.0f, 360.0f);
+                    Vec3 color1 = hsvToRgb(hue1, 0.8f, 0.9f);
+                    Vec3 color2 = hsvToRgb(hue2, 0.6f, 0.7f);
+                    
+                    file << "<stop offset=\"0%\" style=\"stop-color:rgb(" 
+                         << (int)(color1.x*255) << "," << (int)(color1.y*255) << "," << (int)(color1.z*255) << ");stop-opacity:0.9\" />\n";
+                    file << "<stop offset=\"100%\" style=\"stop-color:rgb(" 
+                         << (int)(color2.x*255) << "," << (int)(color2.y*255) << "," << (int)(color2.z*255) << ");stop-opacity:0.6\" />\n";
+                } else {
+                    // Green to yellow gradient for organic look
+                    file << "<stop offset=\"0%\" style=\"stop-color:#90EE90;stop-opacity:0.9\" />\n";
+                    file << "<stop offset=\"100%\" style=\"stop-color:#32CD32;stop-opacity:0.6\" />\n";
+                }
+                file << "</linearGradient>\n";
+            }
+            
+            // Glow filter
+            file << "<filter id=\"glow\">\n";
+            file << "<feGaussianBlur stdDeviation=\"2\" result=\"coloredBlur\"/>\n";
+            file << "<feMerge>\n";
+            file << "<feMergeNode in=\"coloredBlur\"/>\n";
+            file << "<feMergeNode in=\"SourceGraphic\"/>\n";
+            file << "</feMerge>\n";
+            file << "</filter>\n";
+        }
+        
+        file << "</defs>\n";
+        
+        // Background
+        if(style == "gradient" || style == "rainbow") {
+            file << "<rect width=\"100%\" height=\"100%\" fill=\"url(#bg)\"/>\n";
+        } else if(style == "light") {
+            file << "<rect width=\"100%\" height=\"100%\" fill=\"#f8f8f8\"/>\n";
+        } else {
+            file << "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+        }
+        
+        // Render lines with enhanced styling
+        for(int i = 0; i < lines.size(); i++) {
+            const Line& line = lines[i];
+            float x1 = (line.start.x - minBounds.x) * scale + 100;
+            float y1 = height - ((line.start.y - minBounds.y) * scale + 100);
+            float x2 = (line.end.x - minBounds.x) * scale + 100;
+            float y2 = height - ((line.end.y - minBounds.y) * scale + 100);
+            
+            std::string strokeColor;
+            std::string filter = "";
+            float strokeWidth = std::max(0.5f, line.width * 0.8f);
+            
+            if(style == "rainbow") {
+                float hue = std::fmod(i * 137.5f, 360.0f);
+                Vec3 color = hsvToRgb(hue, 0.7f, 0.9f);
+                strokeColor = "rgb(" + std::to_string((int)(color.x*255)) + "," + 
+                             std::to_string((int)(color.y*255)) + "," + 
+                             std::to_string((int)(color.z*255)) + ")";
+                filter = " filter=\"url(#glow)\"";
+            } else if(style == "gradient") {
+                strokeColor = "url(#lineGrad" + std::to_string(i % 10) + ")";
+                filter = " filter=\"url(#glow)\"";
+            } else if(style == "light") {
+                int r = (int)(line.color.x * 180 + 75);
+                int g = (int)(line.color.y * 180 + 75);
+                int b = (int)(line.color.z * 180 + 75);
+                strokeColor = "rgb(" + std::to_string(r) + "," + std::to_string(g) + "," + std::to_string(b) + ")";
+            } else if(style == "depth") {
+                // Color based on distance from center for depth effect
+                float centerX = width / 2;
+                float centerY = height / 2;
+                float dist = std::sqrt((x1-centerX)*(x1-centerX) + (y1-centerY)*(y1-centerY));
+                float maxDist = std::sqrt(centerX*centerX + centerY*centerY);
+                float intensity = 1.0f - (dist / maxDist) * 0.7f;
+                
+                int r = (int)(line.color.x * 255 * intensity);
+                int g = (int)(line.color.y * 255 * intensity);
+                int b = (int)(line.color.z * 255 * intensity);
+                strokeColor = "rgb(" + std::to_string(r) + "," + std::to_string(g) + "," + std::to_string(b) + ")";
+                strokeWidth *= intensity;
+            } else {
+                // Default style
+                int r = (int)(line.color.x * 255);
+                int g = (int)(line.color.y * 255);
+                int b = (int)(line.color.z * 255);
+                strokeColor = "rgb(" + std::to_string(r) + "," + std::to_string(g) + "," + std::to_string(b) + ")";
+            }
+            
+            file << "<line x1=\"" << x1 << "\" y1=\"" << y1 
+                 << "\" x2=\"" << x2 << "\" y2=\"" << y2 
+                 << "\" stroke=\"" << strokeColor
+                 << "\" stroke-width=\"" << strokeWidth 
+                 << "\" stroke-linecap=\"round\""
+                 << filter << "/>\n";
+        }
+        
+        file << "</svg>\n";
+        file.close();
+        progress() << "Enhanced SVG file saved: " << filename << std::endl;
+    }
+    
+    void renderToSVG(const std::string& filename, float scale = 10.0f) {
+        if(lines.empty()) return;
+        
+        // Find bounding box
+        Vec3 minBounds = lines[0].start;
+        Vec3 maxBounds = lines[0].start;
+        
+        for(const Line& line : lines) {
+            minBounds.x = std::min(minBounds.x, std::min(line.start.x, line.end.x));
+            minBounds.y = std::min(minBounds.y, std::min(line.start.y, line.end.y));
+            maxBounds.x = std::max(maxBounds.x, std::max(line.start.x, line.end.x));
+            maxBounds.y = std::max(maxBounds.y, std::max(line.start.y, line.end.y));
+        }
+        
+        float width = (maxBounds.x - minBounds.x) * scale + 100;
+        float height = (maxBounds.y - minBounds.y) * scale + 100;
+        
+        std::ofstream file(filename);
+        file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+        file << "<svg width=\"" << width << "\" height=\"" << height << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+        file << "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+        
+        for(const Line& line : lines) {
+            float x1 = (line.start.x - minBounds.x) * scale + 50;
+            float y1 = height - ((line.start.y - minBounds.y) * scale + 50);
+            float x2 = (line.end.x - minBounds.x) * scale + 50;
+            float y2 = height - ((line.end.y - minBounds.y) * scale + 50);
+            
+            int r = (int)(line.color.x * 255);
+            int g = (int)(line.color.y * 255);
+            int b = (int)(line.color.z * 255);
+            
+            file << "<line x1=\"" << x1 << "\" y1=\"" << y1 
+                 << "\" x2=\"" << x2 << "\" y2=\"" << y2 
+                 << "\" stroke=\"rgb(" << r << "," << g << "," << b 
+                 << ")\" stroke-width=\"" << (line.width * 0.5f) << "\"/>\n";
+        }
+        
+        file << "</svg>\n";
+        file.close();
+        progress() << "SVG file saved: " << filename << std::endl;
+    }
+    
+    // Formats the line list as <polyline> elements into chunks[first] and
+    // on, one chunk per block of segments (`chunks` is resized to fit):
+    // chains of connected segments with the same colour and width become
+    // one element.
+    // Points map to (x - minBounds.x) * scale + margin and are flipped against
+    // `height`. Returns the number of elements.
+    size_t appendPolylines(std::vector<std::string>& chunks, size_t first, const Vec3& minBounds,
+                           float height, float scale, float margin, bool light) const {
+        auto sameStyle = [](const Line& a, const Line& b) {
+            return a.width == b.width && a.color.x == b.color.x &&
+                   a.color.y == b.color.y && a.color.z == b.color.z;
+        };
+        auto pointKey = [](const Vec3& p) {
+            uint32_t x, y;
+            std::memcpy(&x, &p.x, 4);
+            std::memcpy(&y, &p.y, 4);
+            return ((uint64_t)x << 32) | y;
+        };
+        auto appendPoint = [&](std::string& out, const Vec3& p) {
+            appendFixed(out, (p.x - minBounds.x) * scale + margin);
+            out += ',';
+            appendFixed(out, height - ((p.y - minBounds.y) * scale + margin));
+        };
+        
+        const size_t n = lines.size();
+        const size_t chunkSize = std::max<size_t>(4096, n / (omp_get_max_threads() * 4) + 1);
+        const size_t chunkCount = (n + chunkSize - 1) / chunkSize;
+        chunks.resize(first + chunkCount);
+        
+        size_t elements = 0;
+        #pragma omp parallel for schedule(dynamic, 1) reduction(+:elements)
+        for(size_t c = 0; c < chunkCount; c++) {
+            std::string& out = chunks[first + c];
+            const size_t end = std::min(n, (c + 1) * chunkSize);
+            out.reserve((end - c * chunkSize) * 24);
+            
+            // Chain every segment onto the open run that ends where it starts,
+            // so branches that resume after a ']' still extend their trunk.
+            std::vector<std::vector<size_t>> runs;
+            std::unordered_map<uint64_t, size_t> openEnds;
+            for(size_t i = c * chunkSize; i < end; i++) {
+                const Line& line = lines[i];
+                auto found = openEnds.find(pointKey(line.start));
+                if(found != openEnds.end() && sameStyle(lines[runs[found->second].back()], line)) {
+                    size_t run = found->second;
+                    openEnds.erase(found);
+                    runs[run].push_back(i);
+                    openEnds[pointKey(line.end)] = run;
+                } else {
+                    runs.push_back({i});
+                    openEnds[pointKey(line.end)] = runs.size() - 1;
+                }
+            }
+            
+            for(const std::vector<size_t>& run : runs) {
+                const Line& line = lines[run.front()];
+                out += "<polyline points=\"";
+                appendPoint(out, line.start);
+                for(size_t k : run) {
+                    out += ' ';
+                    appendPoint(out, lines[k].end);
+                }
+                out += "\" stroke=\"rgb(";
+                if(light) {
+                    appendInt(out, (int)(line.color.x * 180 + 75)); out += ',';
+                    appendInt(out, (int)(line.color.y * 180 + 75)); out += ',';
+                    appendInt(out, (int)(line.color.z * 180 + 75));
+                } else {
+                    appendInt(out, (int)(line.color.x * 255)); out += ',';
+                    appendInt(out, (int)(line.color.y * 255)); out += ',';
+                    appendInt(out, (int)(line.color.z * 255));
+                }
+                out += ")\" stroke-width=\"";
+                appendFixed(out, light ? std::max(0.5f, line.width * 0.8f) : line.width * 0.5f);
+                out += "\"/>\n";
+            }
+            elements += runs.size();
+        }
+        return elements;
+    }
+    
+    // Same picture as renderToSVG() (or renderToSVGEnhanced() with "light"),
+    // but chains of connected segments with the same colour and width become
+    // one <polyline>. Chunks of the line list are formatted in parallel and
+    // written in order; a ".svgz" name gives gzip output. The other enhanced
+    // styles vary per segment, so there is nothing to merge for them.
+    // Returns false (after printing why) if the file could not be written.
+    bool renderToSVGMerged(const std::string& filename, float scale = 10.0f,
+                           const std::string& style = "plain") {
+        if(lines.empty()) return true;
+        const bool light = style == "light";
+        
+        Vec3 minBounds, maxBounds;
+        frameBounds(minBounds, maxBounds);
+        
+        const float margin = light ? 100.0f : 50.0f;
+        float width = (maxBounds.x - minBounds.x) * scale + 2 * margin;
+        float height = (maxBounds.y - minBounds.y) * scale + 2 * margin;
+        
+        std::vector<std::string> chunks(1);
+        
+        std::string& head = chunks.front();
+        head = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"";
+        appendFixed(head, width);
+        head += "\" height=\"";
+        appendFixed(head, height);
+        head += "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+        head += light ? "<rect width=\"100%\" height=\"100%\" fill=\"#f8f8f8\"/>\n"
+                      : "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+        head += "<g fill=\"none\"";
+        if(light) head += " stroke-linecap=\"round\" stroke-linejoin=\"round\"";
+        head += ">\n";
+        size_t elements = appendPolylines(chunks, 1, minBounds, height, scale, margin, light);
+        chunks.push_back("</g>\n</svg>\n");
+        
+        if(!writeChunks(filename, chunks)) return false;
+        progress() << "SVG file saved: " << filename << " (" << lines.size() << " segments in "
+                   << elements << " polylines)" << std::endl;
+        return true;
+    }
+
+    // Rasterizes the line list straight to .png or .ppm with the framing of
+    // renderToSVG(). Every segment is drawn as an anti-aliased capsule of its
+    // stroke width. The image is split into 64x64 tiles; segments are binned
+    // per tile (in list order, so overlaps blend the same every run) and the
+    // tiles are drawn in parallel. "rainbow" colours segments like
+    // renderToSVGEnhanced() and replaces its per-element feGaussianBlur with
+    // one separable blur over the finished image. Bins hold 32-bit segment
+    // indices, so lists past UINT32_MAX segments are refused.
+    void renderToImage(const std::string& filename, float scale = 10.0f,
+                       const std::string& style = "plain") {
+        if(lines.empty()) return;
+        if(lines.size() > UINT32_MAX) {
+            std::cerr << filename << ": " << lines.size() << " segments, the rasterizer bins at most "
+                      << UINT32_MAX << std::endl;
+            return;
+        }
+        const bool light = style == "light", rainbow = style == "rainbow";
+        
+        Vec3 minBounds, maxBounds;
+        frameBounds(minBounds, maxBounds);
+        
+        const int width = (int)std::ceil((maxBounds.x - minBounds.x) * scale + 100);
+        const int height = (int)std::ceil((maxBounds.y - minBounds.y) * scale + 100);
+        const int tileSize = 64;
+        const int tilesX = (width + tileSize - 1) / tileSize;
+        const int tilesY = (height + tileSize - 1) / tileSize;
+        const Vec3 background = light ? Vec3(0.97f, 0.97f, 0.97f) : Vec3(0, 0, 0);
+        
+        auto toScreen = [&](const Vec3& p) {
+            return Vec3((p.x - minBounds.x) * scale + 50, height - ((p.y - minBounds.y) * scale + 50), 0);
+        };
+        auto halfWidth = [&](const Line& line) {
+            return std::max(0.5f, light ? line.width * 0.4f : line.width * 0.25f);
+        };
+        
+        // Bin segment indices per tile. Each thread bins a contiguous block of
+        // the list, and blocks are concatenated in order. Every thread's bins
+        // are sized up front: inside a task (--batch) the region may run with
+        // fewer threads than omp_get_max_threads().
+        const int threads = omp_get_max_threads();
+        std::vector<std::vector<std::vector<uint32_t>>> localBins(
+            threads, std::vector<std::vector<uint32_t>>((size_t)tilesX * tilesY));
+        #pragma omp parallel num_threads(threads)
+        {
+            std::vector<std::vector<uint32_t>>& bins = localBins[omp_get_thread_num()];
+            #pragma omp for schedule(static)
+            for(size_t i = 0; i < lines.size(); i++) {
+                Vec3 a = toScreen(lines[i].start), b = toScreen(lines[i].end);
+                float r = halfWidth(lines[i]) + 1.0f;
+                int tx0 = std::max(0, (int)((std::min(a.x, b.x) - r) / tileSize));
+                int tx1 = std::min(tilesX - 1, (int)((std::max(a.x, b.x) + r) / tileSize));
+                int ty0 = std::max(0, (int)((std::min(a.y, b.y) - r) / tileSize));
+                int ty1 = std::min(tilesY - 1, (int)((std::max(a.y, b.y) + r) / tileSize));
+                for(int ty = ty0; ty <= ty1; ty++)
+                    for(int tx = tx0; tx <= tx1; tx++)
+                        bins[(size_t)ty * tilesX + tx].push_back((uint32_t)i);
+            }
+        }
+        
+        std::vector<float> image((size_t)width * height * 3);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(int tile = 0; tile < tilesX * tilesY; tile++) {
+            const int x0 = (tile % tilesX) * tileSize, y0 = (tile / tilesX) * tileSize;
+            const int x1 = std::min(width, x0 + tileSize), y1 = std::min(height, y0 + tileSize);
+            for(int y = y0; y < y1; y++) {
+                for(int x = x0; x < x1; x++) {
+                    float* px = &image[((size_t)y * width + x) * 3];
+                    px[0] = background.x; px[1] = background.y; px[2] = background.z;
+                }
+            }
+            
+            for(int t = 0; t < threads; t++) {
+                for(uint32_t i : localBins[t][tile]) {
+                    const Line& line = lines[i];
+                    Vec3 color = line.color;
+                    if(light) color = Vec3(line.color.x * 0.7f + 0.3f, line.color.y * 0.7f + 0.3f,
+                                           line.color.z * 0.7f + 0.3f);
+                    if(rainbow) color = hsvToRgb(std::fmod(i * 137.5f, 360.0f), 0.7f, 0.9f);
+                    
+                    Vec3 a = toScreen(line.start), b = toScreen(line.end);
+                    float r = halfWidth(line);
+                    float dx = b.x - a.x, dy = b.y - a.y;
+                    float len2 = dx * dx + dy * dy;
+                    int sx0 = std::max(x0, (int)std::floor(std::min(a.x, b.x) - r - 1));
+                    int sx1 = std::min(x1 - 1, (int)std::ceil(std::max(a.x, b.x) + r + 1));
+                    int sy0 = std::max(y0, (int)std::floor(std::min(a.y, b.y) - r - 1));
+                    int sy1 = std::min(y1 - 1, (int)std::ceil(std::max(a.y, b.y) + r + 1));
+                    
+                    for(int y = sy0; y <= sy1; y++) {
+                        for(int x = sx0; x <= sx1; x++) {
+                            // Distance from the pixel centre to the segment; one
+                            // pixel of falloff at the edge is the anti-aliasing.
+                            float fx = x + 0.5f - a.x, fy = y + 0.5f - a.y;
+                            float t = len2 > 0 ? std::min(1.0f, std::max(0.0f, (fx * dx + fy * dy) / len2)) : 0.0f;
+                            float ex = fx - t * dx, ey = fy - t * dy;
+                            float coverage = r + 0.5f - std::sqrt(ex * ex + ey * ey);
+                            if(coverage <= 0) continue;
+                            coverage = std::min(1.0f, coverage);
+                            float* dst = &image[((size_t)y * width + x) * 3];
+                            dst[0] += (color.x - dst[0]) * coverage;
+                            dst[1] += (color.y - dst[1]) * coverage;
+                            dst[2] += (color.z - dst[2]) * coverage;
+                        }
+                    }
+                }
+            }
+        }
+        
+        if(rainbow) addGlow(image, width, height, 2.0f);
+        
+        std::vector<unsigned char> rgb(image.size());
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < image.size(); i++) {
+            rgb[i] = (unsigned char)(std::min(1.0f, std::max(0.0f, image[i])) * 255.0f + 0.5f);
+        }
+        if(writeImage(filename, width, height, rgb)) {
+            progress() << "Image saved: " << filename << " (" << width << "x" << height << ")" << std::endl;
+        } else {
+            std::cerr << filename << ": write failed" << std::endl;
+        }
+    }
+};
+
+// Growth animation state. Generations are interpreted through the subtree
+// cache of interpretMemoized(), kept from one generation to the next:
+// entries are keyed by (symbol, remaining depth), so generation N reuses
+// every subtree of generation N - 1 and only adds those one level deeper.
+// Every F/A/B/f written by the last rewrite is new growth if it comes from
+// the successor of a non-drawing symbol, or from inside a branch of a
+// drawing symbol's successor. With its new growth at zero length, a
+// generation therefore has the shape of the previous one for branching
+// grammars (plants, trees). Steps that replace a drawing symbol outside
+// brackets (koch's F -> F+F-F-F+F, sierpinski's A -> B-A-B) are not
+// flagged: their turns change the shape, and shortening the steps alone
+// would not give the old segment back. Such generations are not
+// interpolated; they appear all at once at the first frame of their
+// generation. Turtle positions are sums of steps, so every frame in between
+// is an exact linear blend of the two segment lists and needs no turtle work.
+class GrowthAnimation {
+private:
+    const LSystem& ls;
+    std::vector<uint8_t> ruleGrown[256];
+    TurtleRenderer& renderer;
+    int generation = 0;
+    std::vector<Line> from, to;   // current generation at growth 0 and 1
+    
+public:
+    GrowthAnimation(const LSystem& system, TurtleRenderer& r) : ls(system), renderer(r) {
+        auto drawing = [](char c) { return c == 'F' || c == 'A' || c == 'B'; };
+        for(const auto& rule : ls.getRules()) {
+            unsigned char c = rule.first;
+            int depth = 0;
+            for(char t : rule.second) {
+                if(t == '[') depth++;
+                if(t == ']') depth--;
+                bool steps = drawing(t) || t == 'f';
+                ruleGrown[c].push_back(steps && (!drawing(c) || depth > 0));
+            }
+        }
+        renderer.beginGrowth(ls, ruleGrown);
+    }
+    
+    // Interprets generation N with its new growth at zero and at full
+    // length. Returns false on unbalanced brackets.
+    bool build(int gen) {
+        generation = gen;
+        return renderer.interpretGrowth(ls.getAxiom(), gen, from, to);
+    }
+    
+    // The current generation with its new growth at fraction t.
+    void frame(float t, std::vector<Line>& out) const {
+        out.resize(to.size());
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < to.size(); i++) {
+            out[i] = to[i];
+            out[i].start = from[i].start + (to[i].start - from[i].start) * t;
+            out[i].end = from[i].end + (to[i].end - from[i].end) * t;
+        }
+    }
+    
+    uint64_t symbols() const { return ls.predict(generation).symbols; }
+    const std::vector<Line>& start() const { return from; }
+    const std::vector<Line>& end() const { return to; }
+};
+
+// Tracks the 2D bounding box of every segment; nothing else is kept.
+class BoundsSink : public SegmentSink {
+public:
+    Vec3 minBounds, maxBounds;
+    size_t count = 0;
+    
+    void segment(const Line& line, const TurtleState&) override {
+        if(count++ == 0) {
+            minBounds = maxBounds = line.start;
+        }
+        minBounds.x = std::min(minBounds.x, std::min(line.start.x, line.end.x));
+        minBounds.y = std::min(minBounds.y, std::min(line.start.y, line.end.y));
+        maxBounds.x = std::max(maxBounds.x, std::max(line.start.x, line.end.x));
+        maxBounds.y = std::max(maxBounds.y, std::max(line.start.y, line.end.y));
+    }
+};
+
+// Writes segments as renderToSVG() does, but straight to disk in fixed-size
+// batches, so memory use doesn't depend on the number of segments. The
+// bounds have to be known up front (e.g. from a BoundsSink pass).
+class StreamingSVGWriter : public SegmentSink {
+private:
+    std::ofstream file;
+    std::string batch;
+    size_t batchBytes;
+    Vec3 minBounds;
+    float scale;
+    float height;
+    
+public:
+    size_t count = 0;
+    
+    StreamingSVGWriter(const std::string& filename, const Vec3& minB, const Vec3& maxB,
+                       float sc, size_t batchSize = 1 << 20)
+        : file(filename), batchBytes(batchSize), minBounds(minB), scale(sc) {
+        float width = (maxB.x - minB.x) * scale + 100;
+        height = (maxB.y - minB.y) * scale + 100;
+        batch.reserve(batchBytes + 256);
+        file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+        file << "<svg width=\"" << width << "\" height=\"" << height << "\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+        file << "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+    }
+    
+    ~StreamingSVGWriter() { finish(); }
+    
+    void segment(const Line& line, const TurtleState&) override {
+        char text[256];
+        int n = std::snprintf(text, sizeof(text),
+            "<line x1=\"%g\" y1=\"%g\" x2=\"%g\" y2=\"%g\" stroke=\"rgb(%d,%d,%d)\" stroke-width=\"%g\"/>\n",
+            (line.start.x - minBounds.x) * scale + 50, height - ((line.start.y - minBounds.y) * scale + 50),
+            (line.end.x - minBounds.x) * scale + 50, height - ((line.end.y - minBounds.y) * scale + 50),
+            (int)(line.color.x * 255), (int)(line.color.y * 255), (int)(line.color.z * 255),
+            line.width * 0.5f);
+        batch.append(text, n);
+        count++;
+        if(batch.size() >= batchBytes) flush();
+    }
+    
+    void flush() {
+        file.write(batch.data(), batch.size());
+        batch.clear();
+    }
+    
+    void finish() {
+        if(!file.is_open()) return;
+        flush();
+        file << "</svg>\n";
+        file.close();
+    }
+};
+
+// Sweeps every segment into a tube (a ring of `sides` vertices at each end,
+// oriented by the turtle's left/up vectors, radius proportional to the line
+// width) and streams the mesh to .obj or binary little-endian .ply. When a
+// segment starts where an earlier one ended with the same width (including
+// a trunk resuming after a ']'), it reuses that end ring, so continuous
+// branches form one tube. Segments are buffered
+// in batches; each batch is numbered sequentially and then turned into text or
+// binary records in parallel chunks, written in order. Tubes are open (no
+// caps). PLY needs all vertices before the faces, so faces go to a temporary
+// file that is appended in finish().
+class TubeMeshWriter : public SegmentSink {
+private:
+    struct Segment {
+        Vec3 start, end, left, up;
+        float radius;
+    };
+    
+    std::string filename;
+    bool ply;
+    int sides;
+    float radiusScale;
+    size_t batchSize;
+    std::ofstream file, faceFile;
+    std::vector<Segment> batch;
+    bool indicesFit = true;   // PLY face indices are int32
+    
+    // End rings that a following segment may continue from, keyed by
+    // position and radius.
+    struct RingKey {
+        uint64_t xy, zr;
+        bool operator==(const RingKey& o) const { return xy == o.xy && zr == o.zr; }
+    };
+    struct RingKeyHash {
+        size_t operator()(const RingKey& k) const { return k.xy * 0x9E3779B97F4A7C15ULL ^ k.zr; }
+    };
+    std::unordered_map<RingKey, uint64_t, RingKeyHash> openRings;
+    
+public:
+    uint64_t vertices = 0, faces = 0, segments = 0;
+    
+    TubeMeshWriter(const std::string& name, int sideCount = 8, float radiusPerWidth = 0.1f,
+                   size_t batchSegments = 1 << 16)
+        : filename(name), ply(endsWith(name, ".ply")), sides(std::max(3, sideCount)),
+          radiusScale(radiusPerWidth), batchSize(batchSegments),
+          file(name, std::ios::binary) {
+        batch.reserve(batchSize);
+        if(ply) {
+            faceFile.open(filename + ".faces", std::ios::binary);
+            writePlyHeader();
+        } else {
+            file << "# L-system tube mesh\n";
+        }
+    }
+    
+    ~TubeMeshWriter() { finish(); }
+    
+    void segment(const Line& line, const TurtleState& state) override {
+        batch.push_back({line.start, line.end, state.left, state.up, line.width * radiusScale});
+        if(batch.size() >= batchSize) flush();
+    }
+    
+    void flush() {
+        const size_t n = batch.size();
+        if(n == 0) return;
+        
+        // Sequential pass: which segments reuse an open end ring, and the
+        // first vertex index of each one's new rings.
+        std::vector<uint64_t> startRing(n), firstNew(n);
+        for(size_t i = 0; i < n; i++) {
+            const Segment& seg = batch[i];
+            auto found = openRings.find(ringKey(seg.start, seg.radius));
+            bool shared = found != openRings.end();
+            firstNew[i] = vertices;
+            startRing[i] = shared ? found->second : vertices;
+            if(shared) openRings.erase(found);
+            vertices += shared ? sides : 2 * sides;
+            openRings[ringKey(seg.end, seg.radius)] = vertices - sides;
+        }
+        // Dead ends (branch tips) are never looked up again; bound the table.
+        if(openRings.size() > 4 * batchSize) openRings.clear();
+        faces += (uint64_t)n * sides;
+        segments += n;
+        if(ply && vertices - 1 > (uint64_t)INT32_MAX) {
+            if(indicesFit) {
+                std::cerr << filename << ": over " << (uint64_t)INT32_MAX + 1
+                          << " vertices, too many for PLY's int indices (use .obj)" << std::endl;
+            }
+            indicesFit = false;
+        }
+        if(!indicesFit) {
+            batch.clear();
+            return;
+        }
+        
+        const size_t chunkSize = 4096;
+        const size_t chunkCount = (n + chunkSize - 1) / chunkSize;
+        std::vector<std::string> vertexText(chunkCount), faceText(chunkCount);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for(size_t c = 0; c < chunkCount; c++) {
+            std::string& vout = vertexText[c];
+            std::string& fout = ply ? faceText[c] : vertexText[c];
+            for(size_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++) {
+                const Segment& seg = batch[i];
+                if(startRing[i] == firstNew[i]) appendRing(vout, seg, seg.start);
+                appendRing(vout, seg, seg.end);
+                uint64_t endRing = firstNew[i] + (startRing[i] == firstNew[i] ? sides : 0);
+                for(int k = 0; k < sides; k++) {
+                    int k1 = (k + 1) % sides;
+                    appendQuad(fout, startRing[i] + k, startRing[i] + k1, endRing + k1, endRing + k);
+                }
+            }
+        }
+        for(size_t c = 0; c < chunkCount; c++) {
+            file.write(vertexText[c].data(), vertexText[c].size());
+            if(ply) faceFile.write(faceText[c].data(), faceText[c].size());
+        }
+        batch.clear();
+    }
+    
+    bool finish() {
+        if(!file.is_open()) return true;
+        flush();
+        if(ply) {
+            faceFile.close();
+            std::ifstream faceData(filename + ".faces", std::ios::binary);
+            // Copying an empty buffer sets failbit; with no faces there is nothing to copy.
+            if(faces > 0 && indicesFit) file << faceData.rdbuf();
+            faceData.close();
+            std::remove((filename + ".faces").c_str());
+            file.seekp(0);
+            writePlyHeader();
+        }
+        bool ok = file && indicesFit;
+        file.close();
+        return ok;
+    }
+    
+private:
+    static RingKey ringKey(const Vec3& p, float radius) {
+        float k[4] = {p.x, p.y, p.z, radius};
+        RingKey key;
+        std::memcpy(&key, k, sizeof(key));
+        return key;
+    }
+    
+    void writePlyHeader() {
+        // Fixed-width counts so the header can be rewritten in place at the end.
+        char header[256];
+        int len = std::snprintf(header, sizeof(header),
+            "ply\nformat binary_little_endian 1.0\ncomment L-system tube mesh\n"
+            "element vertex %012llu\nproperty float x\nproperty float y\nproperty float z\n"
+            "element face %012llu\nproperty list uchar int vertex_indices\nend_header\n",
+            (unsigned long long)vertices, (unsigned long long)faces);
+        file.write(header, len);
+    }
+    
+    void appendRing(std::string& out, const Segment& seg, const Vec3& center) const {
+        for(int k = 0; k < sides; k++) {
+            float a = 2.0f * (float)M_PI * k / sides;
+            Vec3 p = center + (seg.left * std::cos(a) + seg.up * std::sin(a)) * seg.radius;
+            if(ply) {
+                float xyz[3] = {p.x, p.y, p.z};
+                out.append((const char*)xyz, sizeof(xyz));
+            } else {
+                out += "v ";
+                appendFixed(out, p.x); out += ' ';
+                appendFixed(out, p.y); out += ' ';
+                appendFixed(out, p.z); out += '\n';
+            }
+        }
+    }
+    
+    void appendQuad(std::string& out, uint64_t a, uint64_t b, uint64_t c, uint64_t d) const {
+        if(ply) {
+            out += (char)4;
+            int32_t idx[4] = {(int32_t)a, (int32_t)b, (int32_t)c, (int32_t)d};
+            out.append((const char*)idx, sizeof(idx));
+        } else {
+            // OBJ indices are 1-based.
+            out += "f";
+            for(uint64_t v : {a, b, c, d}) {
+                char buf[24];
+                buf[0] = ' ';
+                out.append(buf, std::to_chars(buf + 1, buf + sizeof(buf), v + 1).ptr);
+            }
+            out += '\n';
+        }
+    }
+};
+
+// Predefined L-Systems
+namespace LSystems {
+    LSystem dragonCurve() {
+        LSystem ls("F");
+        ls.addRule('F', "F+G");
+        ls.addRule('G', "F-G");
+        return ls;
+    }
+    
+    LSystem sierpinskiTriangle() {
+        LSystem ls("F-G-G");
+        ls.addRule('F', "F-G+F+G-F");
+        ls.addRule('G', "GG");
+        return ls;
+    }
+    
+    LSystem kochCurve() {
+        LSystem ls("F");
+        ls.addRule('F', "F+F-F-F+F");
+        return ls;
+    }
+    
+    LSystem plantA() {
+        LSystem ls("F");
+        ls.addRule('F', "F[+F]F[-F]F");
+        return ls;
+    }
+    
+    LSystem plantB() {
+        LSystem ls("F");
+        ls.addRule('F', "FF-[-F+F+F]+[+F-F-F]");
+        return ls;
+    }
+    
+    LSystem tree3D() {
+        LSystem ls("A");
+        ls.addRule('A', "!![&FL!A]/////'/[&FL!A]///////[&FL!A]");
+        ls.addRule('F', "S //// F");
+        ls.addRule('S', "F L");
+        ls.addRule('L', "['''^^{-f+f+f-|-f+f+f}]");
+        return ls;
+    }
+    
+    LSystem hilbertCurve3D() {
+        LSystem ls("A");
+        ls.addRule('A', "B-F+CFC+F-D&F^D-F+&&CFC+F+B//");
+        ls.addRule('B', "A&F^CFB^F^D^^-F-D^|F^B|FC^F^A//");
+        ls.addRule('C', "|D^|F^B-F+C^F^A&&FA&F^C+F+B^F^D//");
+        ls.addRule('D', "|CFB-F+B|FA&F^A&&FB-F+B|FC//");
+        return ls;
+    }
+    
+    LSystem customBranching() {
+        LSystem ls("F");
+        ls.addRule('F', "F[+F][-F]FF");
+        return ls;
+    }
+    
+    // Named grammars for the command line, with the turn angle and the
+    // line width factor applied at '[' that main() uses.
+    struct Preset {
+        const char* name;
+        LSystem (*make)();
+        float angle;
+        float widthFactor = 0.9f;
+    };
+    
+    const Preset presets[] = {
+        {"dragon", dragonCurve, 90.0f},
+        {"sierpinski", sierpinskiTriangle, 120.0f},
+        {"koch", kochCurve, 90.0f},
+        {"plantA", plantA, 22.0f},
+        {"plantB", plantB, 22.0f},
+        {"tree3D", tree3D, 22.5f, 0.8f},
+        {"hilbert3D", hilbertCurve3D, 90.0f},
+        {"custom", customBranching, 25.0f},
+    };
+    
+    const Preset* findPreset(const std::string& name) {
+        for(const Preset& p : presets) {
+            if(name == p.name) return &p;
+        }
+        std::cerr << "Unknown grammar: " << name << " (known:";
+        for(const Preset& p : presets) std::cerr << " " << p.name;
+        std::cerr << ")" << std::endl;
+        return nullptr;
+    }
+    
+    // Stochastic bush: every F picks one of three rewrites.
+    ParametricLSystem stochasticBush() {
+        ParametricLSystem ls("F");
+        ls.addRule("F -> F[+F]F[-F]F", 0.33f);
+        ls.addRule("F -> F[+F]F", 0.33f);
+        ls.addRule("F -> F[-F]F", 0.34f);
+        return ls;
+    }
+    
+    // Context-sensitive signal propagation (ABOP fig. 1.31a).
+    ParametricLSystem signalPlant() {
+        ParametricLSystem ls("F1F1F1");
+        ls.setIgnore("+-F");
+        ls.addRule("0 < 0 > 0 -> 0");
+        ls.addRule("0 < 0 > 1 -> 1[+F1F1]");
+        ls.addRule("0 < 1 > 0 -> 1");
+        ls.addRule("0 < 1 > 1 -> 1");
+        ls.addRule("1 < 0 > 0 -> 0");
+        ls.addRule("1 < 0 > 1 -> 1F1");
+        ls.addRule("1 < 1 > 0 -> 0");
+        ls.addRule("1 < 1 > 1 -> 0");
+        ls.addRule("+ -> -");
+        ls.addRule("- -> +");
+        return ls;
+    }
+    
+    // Parametric row of trees (ABOP fig. 1.39 construction).
+    ParametricLSystem rowOfTrees() {
+        ParametricLSystem ls("F(100,0)");
+        ls.addRule("F(x,t) : t == 0 -> F(x*0.3,2)+F(x*0.458,1)--F(x*0.458,1)+F(x*0.7,0)");
+        ls.addRule("F(x,t) : t > 0 -> F(x,t-1)");
+        return ls;
+    }
+    
+    struct ParametricPreset {
+        const char* name;
+        ParametricLSystem (*make)();
+        float angle;
+    };
+    
+    const ParametricPreset parametricPresets[] = {
+        {"stochasticBush", stochasticBush, 25.7f},
+        {"signalPlant", signalPlant, 22.5f},
+        {"rowOfTrees", rowOfTrees, 86.0f},
+    };
+}
+
+// Grammar files: one "key value..." per line, '#' starts a comment, and
+// every "grammar <name>" line starts a new grammar. A built-in name
+// (plantA, tree3D, ...) starts from that preset's axiom, rules, angle and
+// width factor.
+//
+//   grammar fern
+//   axiom X
+//   rule X -> F+[[X]-X]-F[-FX]+X
+//   rule F -> FF
+//   angle 25
+//   step 1
+//   width 0.9            # line width factor applied at '['
+//   generations 6
+//   output fern.svg light 12     # file, style, scale
+//   output fern.png plain 4
+//
+// Output types: .svg (plain, rainbow, gradient, light, depth), .svgz
+// (plain, light) and .png/.ppm (plain, light, rainbow).
+struct OutputSpec {
+    std::string file;
+    std::string style = "plain";
+    float scale = 5.0f;
+};
+
+struct GrammarSpec {
+    std::string name;
+    std::string axiom;
+    std::vector<std::pair<char, std::string>> rules;
+    float angle = 25.0f;
+    float step = 1.0f;
+    float widthFactor = 0.9f;
+    int generations = 4;
+    std::vector<OutputSpec> outputs;
+    
+    LSystem make() const {
+        LSystem ls(axiom);
+        for(const auto& rule : rules) ls.addRule(rule.first, rule.second);
+        return ls;
+    }
+};
+
+static bool parseGrammarLine(const std::vector<std::string>& tokens, GrammarSpec& spec, std::string& error) {
+    const std::string& key = tokens[0];
+    auto number = [&](float& out) {
+        if(tokens.size() != 2 || std::sscanf(tokens[1].c_str(), "%f", &out) != 1) {
+            error = "expected one number after " + key;
+            return false;
+        }
+        return true;
+    };
+    if(key == "axiom") {
+        if(tokens.size() != 2) {
+            error = "expected one axiom string";
+            return false;
+        }
+        spec.axiom = tokens[1];
+    } else if(key == "rule") {
+        if(tokens.size() != 4 || tokens[1].size() != 1 || tokens[2] != "->") {
+            error = "expected rule <symbol> -> <successor>";
+            return false;
+        }
+        for(auto& rule : spec.rules) {
+            if(rule.first == tokens[1][0]) {
+                rule.second = tokens[3];
+                return true;
+            }
+        }
+        spec.rules.push_back({tokens[1][0], tokens[3]});
+    } else if(key == "angle") {
+        return number(spec.angle);
+    } else if(key == "step") {
+        return number(spec.step);
+    } else if(key == "width") {
+        return number(spec.widthFactor);
+    } else if(key == "generations") {
+        float gens;
+        if(!number(gens)) return false;
+        if(gens < 0 || gens != (int)gens) {
+            error = "generations must be a whole number";
+            return false;
+        }
+        spec.generations = (int)gens;
+    } else if(key == "output") {
+        if(tokens.size() < 2 || tokens.size() > 4) {
+            error = "expected output <file> [style] [scale]";
+            return false;
+        }
+        OutputSpec out;
+        out.file = tokens[1];
+        if(!endsWith(out.file, ".svg") && !endsWith(out.file, ".svgz") &&
+           !endsWith(out.file, ".png") && !endsWith(out.file, ".ppm")) {
+            error = "unsupported output type '" + out.file + "'";
+            return false;
+        }
+        if(endsWith(out.file, ".svgz") && !haveZlib) {
+            error = "'" + out.file + "': .svgz output needs a build with -DLSYSTEM_ZLIB -lz";
+            return false;
+        }
+        if(tokens.size() >= 3) out.style = tokens[2];
+        if(tokens.size() >= 4 && std::sscanf(tokens[3].c_str(), "%f", &out.scale) != 1) {
+            error = "bad scale '" + tokens[3] + "'";
+            return false;
+        }
+        spec.outputs.push_back(out);
+    } else {
+        error = "unknown key '" + key + "'";
+        return false;
+    }
+    return true;
+}
+
+// Appends the grammars in `path` to `specs`; errors go to stderr with
+// their line numbers.
+bool loadGrammarFile(const std::string& path, std::vector<GrammarSpec>& specs) {
+    std::ifstream in(path);
+    if(!in) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    bool ok = true;
+    const size_t first = specs.size();
+    while(std::getline(in, line)) {
+        ++lineNo;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::vector<std::string> tokens;
+        for(std::string w; words >> w;) tokens.push_back(w);
+        if(tokens.empty()) continue;
+        
+        std::string error;
+        if(tokens[0] == "grammar") {
+            if(tokens.size() != 2) {
+                error = "expected grammar <name>";
+            } else {
+                GrammarSpec spec;
+                spec.name = tokens[1];
+                for(const LSystems::Preset& p : LSystems::presets) {
+                    if(spec.name != p.name) continue;
+                    LSystem ls = p.make();
+                    spec.axiom = ls.getAxiom();
+                    for(const auto& rule : ls.getRules()) spec.rules.push_back(rule);
+                    std::sort(spec.rules.begin(), spec.rules.end());
+                    spec.angle = p.angle;
+                    spec.widthFactor = p.widthFactor;
+                }
+                specs.push_back(spec);
+            }
+        } else if(specs.size() == first) {
+            error = "'" + tokens[0] + "' before the first grammar line";
+        } else {
+            parseGrammarLine(tokens, specs.back(), error);
+        }
+        if(!error.empty()) {
+            std::cerr << path << ":" << lineNo << ": " << error << std::endl;
+            ok = false;
+        }
+    }
+    for(size_t i = first; i < specs.size(); i++) {
+        if(specs[i].axiom.empty()) {
+            std::cerr << path << ": grammar " << specs[i].name << " has no axiom" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Per-stage measurements for --profile: wall time, bytes requested from
+// operator new (with LSYSTEM_ALLOC_COUNT), peak resident memory and bytes
+// written. The peak is the
+// kernel's high-water mark (VmHWM), reset at the start of every stage
+// through /proc/self/clear_refs; where that isn't possible it is the peak
+// since the process started.
+class StageProfiler {
+public:
+    struct Stage {
+        std::string name;
+        std::string unit;        // what `items` counts
+        double seconds = 0;
+        uint64_t items = 0;
+        uint64_t allocated = 0;  // bytes
+        uint64_t allocations = 0;
+        uint64_t peakResident = 0;
+        uint64_t written = 0;
+    };
+    
+    std::vector<Stage> stages;
+    
+    void begin(const std::string& name) {
+        std::ofstream("/proc/self/clear_refs") << "5";
+        current = Stage();
+        current.name = name;
+        startBytes = allocCounter.bytes.load(std::memory_order_relaxed);
+        startCount = allocCounter.count.load(std::memory_order_relaxed);
+        start = omp_get_wtime();
+    }
+    
+    void end(uint64_t items, const std::string& unit, uint64_t written = 0) {
+        current.seconds = omp_get_wtime() - start;
+        current.allocated = allocCounter.bytes.load(std::memory_order_relaxed) - startBytes;
+        current.allocations = allocCounter.count.load(std::memory_order_relaxed) - startCount;
+        current.peakResident = peakResident();
+        current.items = items;
+        current.unit = unit;
+        current.written = written;
+        stages.push_back(current);
+    }
+    
+    static uint64_t peakResident() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while(std::getline(status, line)) {
+            if(line.compare(0, 6, "VmHWM:") == 0) return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+        }
+        return 0;
+    }
+    
+    void printTable(std::ostream& out) const {
+        // The caller's formatting (e.g. std::cout's) is restored at the end.
+        std::ios state(nullptr);
+        state.copyfmt(out);
+        out << std::left << std::setw(16) << "stage" << std::right << std::setw(10) << "seconds"
+            << std::setw(14) << "items" << std::setw(10) << "unit" << std::setw(12) << "M items/s"
+            << std::setw(14) << "alloc (MB)" << std::setw(10) << "allocs" << std::setw(15) << "peak RSS (MB)"
+            << std::setw(14) << "written (MB)" << "\n";
+        for(const Stage& s : stages) {
+            out << std::left << std::setw(16) << s.name << std::right << std::fixed
+                << std::setw(10) << std::setprecision(4) << s.seconds
+                << std::setw(14) << s.items << std::setw(10) << s.unit
+                << std::setw(12) << std::setprecision(2) << (s.seconds > 0 ? s.items / s.seconds / 1e6 : 0.0)
+                << std::setw(14);
+            if(countingAllocations) {
+                out << s.allocated / 1048576.0 << std::setw(10) << s.allocations;
+            } else {
+                out << "-" << std::setw(10) << "-";
+            }
+            out << std::setw(15) << s.peakResident / 1048576.0
+                << std::setw(14) << s.written / 1048576.0 << "\n";
+        }
+        out.copyfmt(state);
+    }
+    
+    // One JSON object; `extra` is inserted verbatim as leading members.
+    void printJSON(std::ostream& out, const std::string& extra) const {
+        out << "{" << extra << "\"stages\": [";
+        for(size_t i = 0; i < stages.size(); i++) {
+            const Stage& s = stages[i];
+            out << (i ? ", " : "") << "{\"name\": \"" << s.name << "\", \"seconds\": " << s.seconds
+                << ", \"items\": " << s.items << ", \"unit\": \"" << s.unit
+                << "\", \"items_per_second\": " << (s.seconds > 0 ? s.items / s.seconds : 0.0)
+                << ", \"bytes_allocated\": " << (countingAllocations ? std::to_string(s.allocated) : "null")
+                << ", \"allocations\": " << (countingAllocations ? std::to_string(s.allocations) : "null")
+                << ", \"peak_rss_bytes\": " << s.peakResident << ", \"bytes_written\": " << s.written << "}";
+        }
+        out << "]}";
+    }
+    
+private:
+    Stage current;
+    uint64_t startBytes = 0, startCount = 0;
+    double start = 0;
+};
+
+// Memory budget for commands that expand a generation in memory; set with
+// --budget <MB> before the command.
+static double memoryBudgetMB = 4096.0;
+
+// Expanding in memory holds the string twice (current and next generation)
+// plus the segment list.
+uint64_t predictedBytes(const LSystem::Growth& g) {
+    double bytes = 2.0 * g.symbols + (double)g.segments * sizeof(Line);
+    return bytes >= 1.8e19 ? UINT64_MAX : (uint64_t)bytes;
+}
+
+// Prints the prediction for generation N and whether it fits the budget.
+bool withinBudget(const LSystem& ls, int generations) {
+    LSystem::Growth g = ls.predict(generations);
+    double mb = predictedBytes(g) / 1048576.0;
+    if(mb <= memoryBudgetMB) return true;
+    std::cerr << "Generation " << generations << " needs about " << mb << " MB ("
+              << g.symbols << " symbols, " << g.segments << " segments), over the "
+              << memoryBudgetMB << " MB budget" << std::endl;
+    return false;
+}
+
+// Per-generation prediction table; nothing is expanded.
+int analyze(const std::string& name, int generations) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    // Columns are wide enough for saturated 64-bit values.
+    std::cout << std::setw(5) << "gen" << std::setw(22) << "symbols" << std::setw(22) << "segments"
+              << std::setw(21) << "max depth" << std::setw(22) << "memory (MB)" << "\n";
+    for(int gen = 0; gen <= generations; gen++) {
+        LSystem::Growth g = ls.predict(gen);
+        std::cout << std::setw(5) << gen << std::setw(22) << g.symbols << std::setw(22) << g.segments
+                  << std::setw(21) << g.maxDepth << std::setw(22) << std::fixed << std::setprecision(1)
+                  << predictedBytes(g) / 1048576.0 << "\n";
+    }
+    return 0;
+}
+
+// Times the string interpreter against compile() + the opcode interpreter
+// and the parallel interpreter, and checks the parallel output is identical.
+int benchTurtle(const std::string& name, int generations) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    ls.iterateParallel(generations);
+    const std::string& str = ls.getString();
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    
+    const int reps = 5;
+    double best = 1e30;
+    for(int r = 0; r < reps; r++) {
+        double t0 = omp_get_wtime();
+        renderer.interpret(str);
+        best = std::min(best, omp_get_wtime() - t0);
+    }
+    
+    double t0 = omp_get_wtime();
+    TurtleProgram prog = renderer.compile(str);
+    double compileTime = omp_get_wtime() - t0;
+    double bestProg = 1e30;
+    for(int r = 0; r < reps; r++) {
+        t0 = omp_get_wtime();
+        renderer.interpret(prog);
+        bestProg = std::min(bestProg, omp_get_wtime() - t0);
+    }
+    
+    std::cout << "\n" << name << " generation " << generations << ": " << str.size() << " symbols, "
+              << prog.code.size() << " ops, " << renderer.segmentCount() << " segments\n";
+    std::cout << "  string interpreter:  " << str.size() / best / 1e6 << " M symbols/s\n";
+    std::cout << "  compile:             " << str.size() / compileTime / 1e6 << " M symbols/s\n";
+    std::cout << "  opcode interpreter:  " << str.size() / bestProg / 1e6 << " M symbols/s ("
+              << best / bestProg << "x)\n";
+    
+    renderer.interpret(str);
+    std::vector<Line> serial = renderer.getLines();
+    double bestPar = 1e30;
+    for(int r = 0; r < reps; r++) {
+        t0 = omp_get_wtime();
+        renderer.interpretParallel(str);
+        bestPar = std::min(bestPar, omp_get_wtime() - t0);
+    }
+    const std::vector<Line>& par = renderer.getLines();
+    bool same = par.size() == serial.size() &&
+                std::memcmp(par.data(), serial.data(), serial.size() * sizeof(Line)) == 0;
+    std::cout << "  parallel interpreter: " << str.size() / bestPar / 1e6 << " M symbols/s ("
+              << best / bestPar << "x on " << omp_get_max_threads() << " threads, "
+              << (same ? "identical to serial" : "DIFFERS from serial") << ")\n";
+    return same ? 0 : 1;
+}
+
+// Fused expand-and-interpret: one streaming pass for the bounds, a second
+// one writing the SVG. Memory stays at O(generations) plus one write batch.
+int renderStreaming(const std::string& name, int generations, const std::string& filename, float scale) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    
+    SymbolStream stream(ls, generations);
+    BoundsSink bounds;
+    size_t symbols = renderer.interpretStream(stream, bounds);
+    if(bounds.count == 0) {
+        std::cerr << "Nothing to draw" << std::endl;
+        return 1;
+    }
+    
+    stream.reset();
+    StreamingSVGWriter writer(filename, bounds.minBounds, bounds.maxBounds, scale);
+    renderer.interpretStream(stream, writer);
+    writer.finish();
+    
+    std::cout << name << " generation " << generations << ": " << symbols << " symbols, "
+              << writer.count << " segments streamed to " << filename << std::endl;
+    return 0;
+}
+
+// Expand + interpret against the subtree geometry cache, which never builds
+// the generation string at all.
+int benchMemo(const std::string& name, int generations, const std::string& filename) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    
+    double t0 = omp_get_wtime();
+    ls.iterateParallel(generations);
+    renderer.interpret(ls.getString());
+    double plain = omp_get_wtime() - t0;
+    
+    t0 = omp_get_wtime();
+    renderer.interpretMemoized(ls, generations);
+    double memo = omp_get_wtime() - t0;
+    
+    std::cout << name << " generation " << generations << ": expand + interpret " << plain
+              << " s, memoized " << memo << " s (" << plain / memo << "x)" << std::endl;
+    if(!filename.empty()) renderer.renderToSVG(filename, 5.0f);
+    return 0;
+}
+
+// Writes generation N with the merged, chunked SVG writer and reports how it
+// compares with the per-<line> writer.
+int writeMergedSVG(const std::string& name, int generations, const std::string& filename,
+                   const std::string& style, float scale) {
+    if(endsWith(filename, ".svgz") && !haveZlib) {
+        std::cerr << filename << ": .svgz output needs a build with -DLSYSTEM_ZLIB -lz" << std::endl;
+        return 1;
+    }
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) {
+        if(endsWith(filename, ".svgz")) return 1;
+        std::cerr << "Switching to streaming output" << std::endl;
+        return renderStreaming(name, generations, filename, scale);
+    }
+    ls.iterateParallel(generations);
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    renderer.interpretParallel(ls.getString());
+    
+    double t0 = omp_get_wtime();
+    if(!renderer.renderToSVGMerged(filename, scale, style)) return 1;
+    std::cout << "merged writer " << omp_get_wtime() - t0 << " s" << std::endl;
+    return 0;
+}
+
+// Times the per-<line> SVG writers against the merged writer, all writing
+// to /dev/null.
+int benchSVG(const std::string& name, int generations, const std::string& style, float scale) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    ls.iterateParallel(generations);
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    renderer.interpretParallel(ls.getString());
+    
+    double t0 = omp_get_wtime();
+    if(style == "light") {
+        renderer.renderToSVGEnhanced("/dev/null", scale, "light");
+    } else {
+        renderer.renderToSVG("/dev/null", scale);
+    }
+    double perLine = omp_get_wtime() - t0;
+    
+    t0 = omp_get_wtime();
+    renderer.renderToSVGMerged("/dev/null", scale, style);
+    double merged = omp_get_wtime() - t0;
+    
+    std::cout << "per-<line> writer " << perLine << " s, merged writer " << merged
+              << " s (" << perLine / merged << "x)" << std::endl;
+    return 0;
+}
+
+// Rasterizes generation N with the built-in tile renderer.
+int writeRaster(const std::string& name, int generations, const std::string& filename,
+                const std::string& style, float scale) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    ls.iterateParallel(generations);
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    renderer.interpretParallel(ls.getString());
+    
+    double t0 = omp_get_wtime();
+    renderer.renderToImage(filename, scale, style);
+    std::cout << renderer.segmentCount() << " segments rasterized in " << omp_get_wtime() - t0
+              << " s" << std::endl;
+    return 0;
+}
+
+// Interprets generation N once and caches the segments in a geometry file.
+int saveGeometry(const std::string& name, int generations, const std::string& filename) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    ls.iterateParallel(generations);
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    renderer.interpretParallel(ls.getString());
+    
+    SegmentStore store;
+    renderer.storeLines(store);
+    if(!store.save(filename)) {
+        std::cerr << filename << ": write failed" << std::endl;
+        return 1;
+    }
+    std::cout << store.x0.size() << " segments (" << store.widths.size() << " widths, "
+              << store.colors.size() / 3 << " colours) saved to " << filename << std::endl;
+    return 0;
+}
+
+// Maps a geometry file and renders it; the output type follows the name
+// (.svg, .svgz, .png, .ppm).
+int renderGeometry(const std::string& filename, const std::string& output, float scale) {
+    MappedSegments mapped;
+    if(!mapped.open(filename)) return 1;
+    
+    double t0 = omp_get_wtime();
+    Vec3 minB, maxB;
+    mapped.view().bounds(minB, maxB);
+    std::cout << mapped.view().count << " segments, bounds (" << minB.x << ", " << minB.y
+              << ") - (" << maxB.x << ", " << maxB.y << ") in " << omp_get_wtime() - t0 << " s"
+              << std::endl;
+    
+    TurtleRenderer renderer(90.0f, 1.0f);
+    renderer.loadLines(mapped.view());
+    if(endsWith(output, ".png") || endsWith(output, ".ppm")) {
+        renderer.renderToImage(output, scale);
+    } else {
+        renderer.renderToSVGMerged(output, scale);
+    }
+    return 0;
+}
+
+// Expands, interprets and meshes generation N in one streaming pass.
+int writeMesh(const std::string& name, int generations, const std::string& filename, int sides) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.setWidthFactor(preset->widthFactor);
+    
+    double t0 = omp_get_wtime();
+    SymbolStream stream(ls, generations);
+    TubeMeshWriter writer(filename, sides);
+    renderer.interpretStream(stream, writer);
+    if(!writer.finish()) {
+        std::cerr << filename << ": write failed" << std::endl;
+        return 1;
+    }
+    std::cout << writer.segments << " tubes, " << writer.vertices << " vertices, " << writer.faces
+              << " faces written to " << filename << " in " << omp_get_wtime() - t0 << " s" << std::endl;
+    return 0;
+}
+
+// Renders generation N at a fixed scale through simplify(), optionally
+// zoomed into a region given as x_min,y_min,x_max,y_max in turtle units,
+// which then sets the output's frame.
+int renderLod(const std::string& name, int generations, const std::string& filename, float scale,
+              const std::string& region) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.interpretMemoized(ls, generations);
+    
+    Vec3 viewMin, viewMax;
+    if(region.empty()) {
+        SegmentStore store;
+        renderer.storeLines(store);
+        store.view().bounds(viewMin, viewMax);
+    } else if(std::sscanf(region.c_str(), "%f,%f,%f,%f", &viewMin.x, &viewMin.y,
+                          &viewMax.x, &viewMax.y) != 4 || viewMax.x <= viewMin.x || viewMax.y <= viewMin.y) {
+        std::cerr << "Bad region: " << region << std::endl;
+        return 1;
+    } else {
+        // Frame the output to the requested region, not to what survives clipping.
+        renderer.setView(viewMin, viewMax);
+    }
+    
+    size_t before = renderer.segmentCount();
+    double t0 = omp_get_wtime();
+    renderer.simplify(scale, viewMin, viewMax);
+    std::cout << before << " segments -> " << renderer.segmentCount() << " after culling and LOD ("
+              << omp_get_wtime() - t0 << " s)" << std::endl;
+    if(renderer.segmentCount() == 0) {
+        std::cerr << "Nothing visible in the region" << std::endl;
+        return 1;
+    }
+    if(endsWith(filename, ".png") || endsWith(filename, ".ppm")) {
+        renderer.renderToImage(filename, scale);
+    } else {
+        renderer.renderToSVGMerged(filename, scale);
+    }
+    return 0;
+}
+
+// Expands one of the parametric presets and writes it as SVG.
+int renderParametric(const std::string& name, int generations, const std::string& filename) {
+    for(const LSystems::ParametricPreset& p : LSystems::parametricPresets) {
+        if(name != p.name) continue;
+        ParametricLSystem ls = p.make();
+        double t0 = omp_get_wtime();
+        ls.iterate(generations);
+        double seconds = omp_get_wtime() - t0;
+        TurtleRenderer renderer(p.angle, 1.0f);
+        renderer.interpret(ls.getWord());
+        renderer.renderToSVGMerged(filename, name == std::string("rowOfTrees") ? 1.0f : 5.0f);
+        std::cout << ls.getWord().size() << " modules rewritten in " << seconds << " s" << std::endl;
+        return 0;
+    }
+    std::cerr << "Unknown parametric grammar: " << name << " (known:";
+    for(const LSystems::ParametricPreset& p : LSystems::parametricPresets) std::cerr << " " << p.name;
+    std::cerr << ")" << std::endl;
+    return 1;
+}
+
+// Runs a plain grammar through both rewriters to show what the general
+// rule machinery costs on the simple case. "all" runs every preset and
+// fails if any of them comes out different.
+int benchRewrite(const std::string& name, int generations) {
+    if(name == "all") {
+        int failed = 0;
+        for(const LSystems::Preset& p : LSystems::presets) {
+            if(benchRewrite(p.name, generations) != 0) failed++;
+        }
+        return failed == 0 ? 0 : 1;
+    }
+    
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    double t0 = omp_get_wtime();
+    ls.iterateParallel(generations);
+    double plain = omp_get_wtime() - t0;
+    
+    ParametricLSystem pls(ls);
+    t0 = omp_get_wtime();
+    pls.iterate(generations);
+    double general = omp_get_wtime() - t0;
+    
+    bool same = pls.getWord().symbols == ls.getString();
+    std::cout << name << " generation " << generations << ": char rewrite " << plain
+              << " s, rule table rewrite " << general << " s (" << general / plain << "x), output "
+              << (same ? "identical" : "DIFFERENT") << std::endl;
+    return same ? 0 : 1;
+}
+
+// Push/pop throughput of the turtle's branch stack against the
+// std::stack<TurtleState> it replaced, on the brackets of a real string.
+int benchStack(const std::string& name, int generations) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    ls.iterateParallel(generations);
+    const std::string& str = ls.getString();
+    size_t pushes = std::count(str.begin(), str.end(), '[');
+    if(pushes == 0) {
+        std::cerr << name << " has no brackets" << std::endl;
+        return 1;
+    }
+    
+    const int reps = 5;
+    double bestStack = 1e30, bestArena = 1e30;
+    float check = 0;
+    for(int r = 0; r < reps; r++) {
+        TurtleState state;
+        std::stack<TurtleState> stack;
+        double t0 = omp_get_wtime();
+        for(char c : str) {
+            if(c == '[') {
+                stack.push(state);
+                state.lineWidth *= 0.9f;
+            } else if(c == ']' && !stack.empty()) {
+                state = stack.top();
+                stack.pop();
+            }
+        }
+        bestStack = std::min(bestStack, omp_get_wtime() - t0);
+        check += state.lineWidth;
+        
+        state = TurtleState();
+        StateArena arena;
+        arena.reserve(ls.predict(generations).maxDepth);
+        t0 = omp_get_wtime();
+        for(char c : str) {
+            if(c == '[') {
+                arena.push(state);
+                state.lineWidth *= 0.9f;
+            } else if(c == ']' && !arena.empty()) {
+                arena.pop(state);
+            }
+        }
+        bestArena = std::min(bestArena, omp_get_wtime() - t0);
+        check += state.lineWidth;
+    }
+    
+    std::cout << name << " generation " << generations << ": " << pushes << " push/pop pairs, depth "
+              << ls.predict(generations).maxDepth << " (check " << check << ")\n";
+    std::cout << "  std::stack<TurtleState>: " << pushes / bestStack / 1e6 << " M pairs/s ("
+              << sizeof(TurtleState) << " bytes/state)\n";
+    std::cout << "  StateArena:              " << pushes / bestArena / 1e6 << " M pairs/s ("
+              << bestStack / bestArena << "x)" << std::endl;
+    return 0;
+}
+
+// True if `pattern` holds exactly one integer conversion (%d or %0Nd) and
+// no other conversion but %%, so it is safe as an snprintf format.
+bool isFramePattern(const std::string& pattern) {
+    int conversions = 0;
+    for(size_t i = 0; i < pattern.size(); i++) {
+        if(pattern[i] != '%') continue;
+        if(++i < pattern.size() && pattern[i] == '%') continue;
+        if(i < pattern.size() && pattern[i] == '0') i++;
+        while(i < pattern.size() && std::isdigit((unsigned char)pattern[i])) i++;
+        if(i >= pattern.size() || pattern[i] != 'd') return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// Growth animation for generations 0..N with `steps` frames per
+// generation. A name with a printf pattern (growth_%04d.png, .ppm or .svg)
+// gives numbered frames; a plain .svg name gives one animated SVG whose
+// frames are shown in turn by discrete <animate> timing at 12 frames/s,
+// holding the last one for two seconds. Frames are size x size pixels.
+// Within a generation the view moves from the bounds of the old shape to
+// those of the new one, so consecutive frames line up. Frames without
+// segments (an axiom with nothing to draw) are skipped.
+int writeAnimation(const std::string& name, int generations, const std::string& filename,
+                   int steps, int size, const std::string& style) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    const bool numbered = filename.find('%') != std::string::npos;
+    const bool image = endsWith(filename, ".png") || endsWith(filename, ".ppm");
+    if((!numbered && !endsWith(filename, ".svg")) || (numbered && !isFramePattern(filename))) {
+        std::cerr << filename << ": use a .svg name, or a numbered pattern such as frame_%04d.png "
+                  << "(one %d or %0Nd, %% for a literal %)" << std::endl;
+        return 1;
+    }
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    steps = std::max(1, steps);
+    
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    const bool light = style == "light";
+    const float margin = (light && !image) ? 100.0f : 50.0f;
+    
+    std::ofstream animated;
+    const double frameTime = 1.0 / 12.0, hold = 2.0;
+    const int frameTotal = generations * steps + 1;
+    const double duration = frameTotal * frameTime + hold;
+    if(!numbered) {
+        animated.open(filename, std::ios::binary);
+        animated << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"" << size << "\" height=\""
+                 << size << "\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+                 << (light ? "<rect width=\"100%\" height=\"100%\" fill=\"#f8f8f8\"/>\n"
+                           : "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n")
+                 << "<g fill=\"none\""
+                 << (light ? " stroke-linecap=\"round\" stroke-linejoin=\"round\"" : "") << ">\n";
+        animated << std::setprecision(6);
+    }
+    
+    double t0 = omp_get_wtime();
+    GrowthAnimation anim(ls, renderer);
+    std::vector<Line> frame;
+    std::vector<std::string> chunks;
+    int written = 0;
+    size_t segments = 0;
+    for(int gen = 0; gen <= generations; gen++) {
+        if(!anim.build(gen)) {
+            std::cerr << name << ": unbalanced brackets in the rules" << std::endl;
+            return 1;
+        }
+        
+        Vec3 fromMin, fromMax, toMin, toMax;
+        lineBounds(anim.start(), fromMin, fromMax);
+        lineBounds(anim.end(), toMin, toMax);
+        if(fromMax.x - fromMin.x <= 0 && fromMax.y - fromMin.y <= 0) {
+            fromMin = toMin;
+            fromMax = toMax;
+        }
+        
+        for(int s = gen == 0 ? steps : 1; s <= steps; s++) {
+            int index = gen == 0 ? 0 : (gen - 1) * steps + s;
+            float t = (float)s / steps;
+            anim.frame(t, frame);
+            if(frame.empty()) continue;
+            
+            // Square view around the blended bounds, scaled to fill the frame.
+            Vec3 lo = fromMin + (toMin - fromMin) * t, hi = fromMax + (toMax - fromMax) * t;
+            float extent = std::max(hi.x - lo.x, hi.y - lo.y);
+            if(extent <= 0) extent = 1.0f;
+            Vec3 center = (lo + hi) * 0.5f;
+            Vec3 viewMin(center.x - extent / 2, center.y - extent / 2, 0);
+            Vec3 viewMax(center.x + extent / 2, center.y + extent / 2, 0);
+            // Slightly under the exact fit, so rounding never adds a pixel.
+            float scale = (size - 2 * margin) / extent * 0.99999f;
+            
+            renderer.swapLines(frame);
+            if(numbered) {
+                char path[4096];
+                std::snprintf(path, sizeof(path), filename.c_str(), index);
+                renderer.setView(viewMin, viewMax);
+                if(image) {
+                    renderer.renderToImage(path, scale, style);
+                } else {
+                    renderer.renderToSVGMerged(path, scale, style);
+                }
+                renderer.clearView();
+            } else {
+                double begin = index * frameTime / duration, end = (index + 1) * frameTime / duration;
+                animated << "<g visibility=\"hidden\"><animate attributeName=\"visibility\" dur=\"" << duration
+                         << "s\" repeatCount=\"indefinite\" calcMode=\"discrete\" ";
+                if(index == frameTotal - 1) {
+                    animated << "values=\"hidden;visible\" keyTimes=\"0;" << begin << "\"/>\n";
+                } else if(index == 0) {
+                    animated << "values=\"visible;hidden\" keyTimes=\"0;" << end << "\"/>\n";
+                } else {
+                    animated << "values=\"hidden;visible;hidden\" keyTimes=\"0;" << begin << ";" << end << "\"/>\n";
+                }
+                renderer.appendPolylines(chunks, 0, viewMin, (float)size, scale, margin, light);
+                for(const std::string& chunk : chunks) animated.write(chunk.data(), chunk.size());
+                animated << "</g>\n";
+            }
+            renderer.swapLines(frame);
+            written++;
+            segments += frame.size();
+        }
+    }
+    if(!numbered) {
+        animated << "</g>\n</svg>\n";
+        if(!animated) {
+            std::cerr << filename << ": write failed" << std::endl;
+            return 1;
+        }
+    }
+    
+    std::cout << name << ": " << written << " frames over " << generations << " generations ("
+              << anim.symbols() << " symbols, " << segments << " segments drawn) in "
+              << omp_get_wtime() - t0 << " s" << std::endl;
+    return 0;
+}
+
+// Renders every output of every grammar in the given files in one process.
+// Grammars with the same axiom, rules and generation count are expanded
+// once, and outputs that also share angle, step and width factor are drawn
+// from one interpretation, like the styles of one renderer in main().
+// Expansion groups run as OpenMP tasks on the shared thread pool, and
+// each output of a group is its own task.
+int runBatch(const std::vector<std::string>& files) {
+    std::vector<GrammarSpec> specs;
+    bool ok = true;
+    for(const std::string& file : files) ok = loadGrammarFile(file, specs) && ok;
+    if(!ok) return 1;
+    
+    struct Job {
+        const GrammarSpec* spec;
+        const OutputSpec* output;
+        std::string result;
+    };
+    std::vector<Job> jobs;
+    std::vector<std::string> keys;
+    std::unordered_map<std::string, std::vector<size_t>> groups;
+    for(const GrammarSpec& spec : specs) {
+        if(spec.outputs.empty()) {
+            std::cerr << "grammar " << spec.name << " has no outputs" << std::endl;
+            continue;
+        }
+        if(!withinBudget(spec.make(), spec.generations)) return 1;
+        std::vector<std::pair<char, std::string>> rules = spec.rules;
+        std::sort(rules.begin(), rules.end());
+        std::string key = spec.axiom + "\n" + std::to_string(spec.generations);
+        for(const auto& rule : rules) key += "\n" + std::string(1, rule.first) + rule.second;
+        if(!groups.count(key)) keys.push_back(key);
+        for(const OutputSpec& out : spec.outputs) {
+            groups[key].push_back(jobs.size());
+            jobs.push_back({&spec, &out, ""});
+        }
+    }
+    
+    // Each task collects its progress messages and prints them in one
+    // piece, so lines of concurrent jobs don't interleave.
+    auto flush = [](std::ostringstream& log) {
+        #pragma omp critical(batchOutput)
+        std::cout << log.str() << std::flush;
+        log.str("");
+    };
+    
+    auto render = [&](TurtleRenderer& renderer, Job& job) {
+        std::ostringstream log;
+        ProgressTo redirect(log);
+        const OutputSpec& out = *job.output;
+        double t0 = omp_get_wtime();
+        if(endsWith(out.file, ".png") || endsWith(out.file, ".ppm")) {
+            renderer.renderToImage(out.file, out.scale, out.style);
+        } else if(endsWith(out.file, ".svgz")) {
+            renderer.renderToSVGMerged(out.file, out.scale, out.style);
+        } else if(out.style == "plain") {
+            renderer.renderToSVG(out.file, out.scale);
+        } else {
+            renderer.renderToSVGEnhanced(out.file, out.scale, out.style);
+        }
+        std::ostringstream msg;
+        msg << out.file << ": " << job.spec->name << ", " << out.style << ", "
+            << renderer.segmentCount() << " segments, " << omp_get_wtime() - t0 << " s";
+        job.result = msg.str();
+        flush(log);
+    };
+    
+    auto runGroup = [&](const std::vector<size_t>& members) {
+        std::ostringstream log;
+        ProgressTo redirect(log);
+        const GrammarSpec& first = *jobs[members[0]].spec;
+        LSystem ls = first.make();
+        ls.iterateParallel(first.generations);
+        
+        // One interpretation per distinct turtle setup in the group.
+        std::vector<bool> done(members.size(), false);
+        for(size_t m = 0; m < members.size(); m++) {
+            if(done[m]) continue;
+            const GrammarSpec& spec = *jobs[members[m]].spec;
+            TurtleRenderer renderer(spec.angle, spec.step);
+            renderer.setWidthFactor(spec.widthFactor);
+            renderer.reserveDepth(ls.predict(spec.generations).maxDepth);
+            renderer.interpretParallel(ls.getString());
+            flush(log);
+            for(size_t o = m; o < members.size(); o++) {
+                const GrammarSpec& other = *jobs[members[o]].spec;
+                if(done[o] || other.angle != spec.angle || other.step != spec.step ||
+                   other.widthFactor != spec.widthFactor) continue;
+                done[o] = true;
+                Job& job = jobs[members[o]];
+                #pragma omp task shared(renderer, job)
+                render(renderer, job);
+            }
+            #pragma omp taskwait
+        }
+    };
+    
+    double t0 = omp_get_wtime();
+    #pragma omp parallel
+    #pragma omp single
+    for(const std::string& key : keys) {
+        const std::vector<size_t>& members = groups[key];
+        #pragma omp task
+        runGroup(members);
+    }
+    
+    std::cout << "\n";
+    for(const Job& job : jobs) std::cout << job.result << "\n";
+    std::cout << jobs.size() << " outputs from " << keys.size() << " expansions in "
+              << omp_get_wtime() - t0 << " s" << std::endl;
+    return 0;
+}
+
+// Runs expansion, interpretation, bounds and SVG emission for every
+// grammar x generation pair under the stage profiler. Prints a table per
+// run and, if a report name is given, writes all runs there as a JSON array.
+// The SVG stage writes profile_<grammar>_<gens>.svg in the current
+// directory. Pairs over the memory budget are skipped.
+int profilePipeline(const std::string& grammars, const std::string& generationList, const std::string& report) {
+    auto split = [](const std::string& list) {
+        std::vector<std::string> items;
+        std::istringstream in(list);
+        for(std::string item; std::getline(in, item, ',');) {
+            if(!item.empty()) items.push_back(item);
+        }
+        return items;
+    };
+    
+    std::vector<std::string> runs;
+    bool skipped = false;
+    for(const std::string& name : split(grammars)) {
+        const LSystems::Preset* preset = LSystems::findPreset(name);
+        if(!preset) return 1;
+        for(const std::string& gen : split(generationList)) {
+            int generations = std::atoi(gen.c_str());
+            LSystem ls = preset->make();
+            if(!withinBudget(ls, generations)) {
+                skipped = true;
+                continue;
+            }
+            TurtleRenderer renderer(preset->angle, 1.0f);
+            renderer.reserveDepth(ls.predict(generations).maxDepth);
+            std::string svg = "profile_" + name + "_" + std::to_string(generations) + ".svg";
+            StageProfiler prof;
+            
+            prof.begin("expansion");
+            ls.iterateParallel(generations);
+            prof.end(ls.getString().size(), "symbols");
+            
+            prof.begin("interpretation");
+            renderer.interpretParallel(ls.getString());
+            prof.end(ls.getString().size(), "symbols");
+            
+            prof.begin("bounds");
+            Vec3 minBounds, maxBounds;
+            lineBounds(renderer.getLines(), minBounds, maxBounds);
+            prof.end(renderer.segmentCount(), "segments");
+            
+            prof.begin("svg");
+            renderer.renderToSVGMerged(svg, 5.0f);
+            struct stat st;
+            prof.end(renderer.segmentCount(), "segments", stat(svg.c_str(), &st) == 0 ? st.st_size : 0);
+            
+            std::cout << "\n" << name << " generation " << generations << " (" << omp_get_max_threads()
+                      << " threads, bounds " << minBounds.x << "," << minBounds.y << " to " << maxBounds.x
+                      << "," << maxBounds.y << "):\n";
+            prof.printTable(std::cout);
+            std::ostringstream json;
+            json << std::setprecision(9);
+            prof.printJSON(json, "\"grammar\": \"" + name + "\", \"generations\": " + std::to_string(generations) +
+                                 ", \"threads\": " + std::to_string(omp_get_max_threads()) + ", ");
+            runs.push_back(json.str());
+        }
+    }
+    
+    if(!report.empty()) {
+        std::ofstream out(report);
+        out << "[\n";
+        for(size_t i = 0; i < runs.size(); i++) out << "  " << runs[i] << (i + 1 < runs.size() ? ",\n" : "\n");
+        out << "]\n";
+        if(!out) {
+            std::cerr << report << ": write failed" << std::endl;
+            return 1;
+        }
+        std::cout << "\nReport written to " << report << std::endl;
+    }
+    return skipped ? 1 : 0;
+}
+
+// Projects generation N through a camera and renders it back to front.
+int renderView3D(const std::string& name, int generations, const std::string& filename,
+                 const Camera& camera, float scale) {
+    const LSystems::Preset* preset = LSystems::findPreset(name);
+    if(!preset) return 1;
+    
+    LSystem ls = preset->make();
+    if(!withinBudget(ls, generations)) return 1;
+    ls.iterateParallel(generations);
+    TurtleRenderer renderer(preset->angle, 1.0f);
+    renderer.setWidthFactor(preset->widthFactor);
+    renderer.reserveDepth(ls.predict(generations).maxDepth);
+    renderer.interpretParallel(ls.getString());
+    
+    double t0 = omp_get_wtime();
+    if(!renderer.projectLines(camera)) return 1;
+    double seconds = omp_get_wtime() - t0;
+    std::cout << renderer.segmentCount() << " segments projected and depth sorted in " << seconds << " s ("
+              << renderer.segmentCount() / seconds / 1e6 << " M segments/s)" << std::endl;
+    
+    if(endsWith(filename, ".png") || endsWith(filename, ".ppm")) {
+        renderer.renderToImage(filename, scale);
+    } else {
+        renderer.renderToSVGMerged(filename, scale);
+    }
+    return 0;
+}
+
+int runCommand(int argc, char* argv[]) {
+    if(std::string(argv[1]) == "--budget" && argc >= 4) {
+        memoryBudgetMB = std::atof(argv[2]);
+        argv[2] = argv[0];
+        return runCommand(argc - 2, argv + 2);
+    }
+    std::string cmd = argv[1];
+    if(cmd == "--analyze" && argc >= 4) {
+        return analyze(argv[2], std::atoi(argv[3]));
+    }
+    if(cmd == "--bench-turtle" && argc >= 4) {
+        return benchTurtle(argv[2], std::atoi(argv[3]));
+    }
+    if(cmd == "--stream" && argc >= 5) {
+        float scale = argc >= 6 ? (float)std::atof(argv[5]) : 5.0f;
+        return renderStreaming(argv[2], std::atoi(argv[3]), argv[4], scale);
+    }
+    if(cmd == "--svg" && argc >= 5) {
+        std::string style = argc >= 6 ? argv[5] : "plain";
+        float scale = argc >= 7 ? (float)std::atof(argv[6]) : 5.0f;
+        return writeMergedSVG(argv[2], std::atoi(argv[3]), argv[4], style, scale);
+    }
+    if(cmd == "--bench-svg" && argc >= 4) {
+        std::string style = argc >= 5 ? argv[4] : "plain";
+        float scale = argc >= 6 ? (float)std::atof(argv[5]) : 5.0f;
+        return benchSVG(argv[2], std::atoi(argv[3]), style, scale);
+    }
+    if(cmd == "--raster" && argc >= 5) {
+        std::string style = argc >= 6 ? argv[5] : "plain";
+        float scale = argc >= 7 ? (float)std::atof(argv[6]) : 5.0f;
+        return writeRaster(argv[2], std::atoi(argv[3]), argv[4], style, scale);
+    }
+    if(cmd == "--save-geometry" && argc >= 5) {
+        return saveGeometry(argv[2], std::atoi(argv[3]), argv[4]);
+    }
+    if(cmd == "--render-geometry" && argc >= 4) {
+        float scale = argc >= 5 ? (float)std::atof(argv[4]) : 5.0f;
+        return renderGeometry(argv[2], argv[3], scale);
+    }
+    if(cmd == "--mesh" && argc >= 5) {
+        return writeMesh(argv[2], std::atoi(argv[3]), argv[4], argc >= 6 ? std::atoi(argv[5]) : 8);
+    }
+    if(cmd == "--lod" && argc >= 6) {
+        return renderLod(argv[2], std::atoi(argv[3]), argv[4], (float)std::atof(argv[5]),
+                         argc >= 7 ? argv[6] : "");
+    }
+    if(cmd == "--parametric" && argc >= 5) {
+        return renderParametric(argv[2], std::atoi(argv[3]), argv[4]);
+    }
+    if(cmd == "--bench-rewrite" && argc >= 4) {
+        return benchRewrite(argv[2], std::atoi(argv[3]));
+    }
+    if(cmd == "--view3d" && argc >= 5) {
+        Camera camera;
+        camera.perspective = argc >= 6 && std::string(argv[5]) == "perspective";
+        if(argc >= 7 && std::sscanf(argv[6], "%f,%f,%f", &camera.direction.x, &camera.direction.y,
+                                    &camera.direction.z) != 3) {
+            std::cerr << "Bad view direction: " << argv[6] << std::endl;
+            return 1;
+        }
+        float scale = argc >= 8 ? (float)std::atof(argv[7]) : 10.0f;
+        return renderView3D(argv[2], std::atoi(argv[3]), argv[4], camera, scale);
+    }
+    if(cmd == "--profile" && argc >= 4) {
+        return profilePipeline(argv[2], argv[3], argc >= 5 ? argv[4] : "");
+    }
+    if(cmd == "--batch" && argc >= 3) {
+        return runBatch(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    if(cmd == "--animate" && argc >= 5) {
+        int steps = argc >= 6 ? std::atoi(argv[5]) : 8;
+        int size = argc >= 7 ? std::atoi(argv[6]) : 800;
+        return writeAnimation(argv[2], std::atoi(argv[3]), argv[4], steps, size, argc >= 8 ? argv[7] : "plain");
+    }
+    if(cmd == "--bench-stack" && argc >= 4) {
+        return benchStack(argv[2], std::atoi(argv[3]));
+    }
+    if(cmd == "--memo" && argc >= 4) {
+        return benchMemo(argv[2], std::atoi(argv[3]), argc >= 5 ? argv[4] : "");
+    }
+    std::cerr << "Usage: lsystem                                          render the demo set\n"
+              << "       lsystem --analyze <grammar> <gens>               predict sizes without expanding\n"
+              << "       lsystem --budget <MB> <command...>               memory budget for in-memory commands (default 4096)\n"
+              << "       lsystem --bench-turtle <grammar> <gens>          time the turtle interpreters\n"
+              << "       lsystem --bench-stack <grammar> <gens>           branch stack push/pop throughput\n"
+              << "       lsystem --stream <grammar> <gens> <out.svg> [scale]\n"
+              << "                                                        expand, interpret and write in one bounded-memory pass\n"
+              << "       lsystem --memo <grammar> <gens> [out.svg]        interpret through the subtree geometry cache\n"
+              << "       lsystem --svg <grammar> <gens> <out.svg|out.svgz> [plain|light] [scale]\n"
+              << "                                                        write merged polylines, formatted in parallel\n"
+              << "       lsystem --bench-svg <grammar> <gens> [plain|light] [scale]\n"
+              << "                                                        per-<line> SVG writers vs. the merged writer\n"
+              << "       lsystem --raster <grammar> <gens> <out.png|out.ppm> [plain|light|rainbow] [scale]\n"
+              << "                                                        rasterize with anti-aliased lines\n"
+              << "       lsystem --save-geometry <grammar> <gens> <file.lsg>\n"
+              << "                                                        cache interpreted segments in a binary file\n"
+              << "       lsystem --render-geometry <file.lsg> <out.svg|out.png> [scale]\n"
+              << "                                                        render cached segments without interpreting\n"
+              << "       lsystem --mesh <grammar> <gens> <out.obj|out.ply> [sides]\n"
+              << "                                                        stream a tube mesh for 3D viewers\n"
+              << "       lsystem --lod <grammar> <gens> <out.svg|out.png> <scale> [x_min,y_min,x_max,y_max]\n"
+              << "                                                        cull to a region and drop sub-pixel detail\n"
+              << "       lsystem --parametric <stochasticBush|signalPlant|rowOfTrees> <gens> <out.svg>\n"
+              << "                                                        stochastic, context-sensitive and parametric grammars\n"
+              << "       lsystem --bench-rewrite <grammar|all> <gens>     plain char rewrite vs. the general rule table\n"
+              << "       lsystem --view3d <grammar> <gens> <out.svg|out.png> [ortho|perspective] [dx,dy,dz] [scale]\n"
+              << "                                                        project through a camera, draw back to front\n"
+              << "       lsystem --profile <grammar,...> <gens,...> [report.json]\n"
+              << "                                                        time, memory and output per pipeline stage;\n"
+              << "                                                        writes profile_<grammar>_<gens>.svg\n"
+              << "       lsystem --batch <file.lsys...>                   render every output of the grammar files\n"
+              << "       lsystem --animate <grammar> <gens> <out.svg|frame_%04d.png|frame_%04d.svg> [steps] [size] [plain|light]\n"
+              << "                                                        growth animation, steps frames per generation\n";
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc > 1) return runCommand(argc, argv);
+    
     std::cout << "Enhanced L-System Renderer\n";
     std::cout << "=========================\n\n";
     
     // Example 1: Dragon Curve - Multiple styles
     std::cout << "1. Dragon Curve (Multiple Styles):\n";
     LSystem dragon = LSystems::dragonCurve();
-    dragon.iterate(12);
+    dragon.iterateParallel(12);
     
     TurtleRenderer renderer1(90.0f, 1.0f);
     renderer1.interpret(dragon.getString());
@@ -584,30 +4843,30 @@ int main() {
     // Example 2: Plant A - Enhanced versions
     std::cout << "\n2. Plant A (Enhanced):\n";
     LSystem plant = LSystems::plantA();
-    plant.iterate(6);
+    plant.iterateParallel(6);
     
     TurtleRenderer renderer2(22.0f, 1.0f);
     renderer2.interpret(plant.getString());
     renderer2.renderToSVGEnhanced("plant_gradient.svg", 12.0f, "gradient");
     renderer2.renderToSVGEnhanced("plant_light.svg", 12.0f, "light");
-    //    renderer2.renderToPLY("plant_a.ply");
+    writeMesh("plantA", 6, "plant_a.ply", 8);
     
     // Example 3: 3D Tree
     std::cout << "\n3. 3D Tree:\n";
     LSystem tree = LSystems::tree3D();
-    tree.iterate(3);
+    tree.iterateParallel(3);
     
     TurtleRenderer renderer3(22.5f, 1.0f);
     renderer3.setWidthFactor(0.8f);
     renderer3.interpret(tree.getString());
     renderer3.renderToSVGEnhanced("tree_depth.svg", 8.0f, "depth");
-    // renderer3.renderToOBJ("tree_3d.obj");
-    // renderer3.renderToPLY("tree_3d.ply");
+    writeMesh("tree3D", 3, "tree_3d.obj", 8);
+    writeMesh("tree3D", 3, "tree_3d.ply", 8);
     
     // Example 4: Koch Curve - Rainbow style
     std::cout << "\n4. Koch Curve (Rainbow):\n";
     LSystem koch = LSystems::kochCurve();
-    koch.iterate(5);
+    koch.iterateParallel(5);
     
     TurtleRenderer renderer4(90.0f, 1.0f);
     renderer4.interpret(koch.getString());
@@ -618,7 +4877,7 @@ int main() {
     std::cout << "\n5. Custom Branching Pattern:\n";
     LSystem custom("F");
     custom.addRule('F', "F[+F][-F]FF");
-    custom.iterate(5);
+    custom.iterateParallel(5);
     
     TurtleRenderer renderer5(25.0f, 1.0f);
     renderer5.interpret(custom.getString());
@@ -628,7 +4887,7 @@ int main() {
     // Example 6: Sierpinski Triangle - Special case
     std::cout << "\n6. Sierpinski Triangle (Rainbow):\n";
     LSystem sierpinski = LSystems::sierpinskiTriangle();
-    sierpinski.iterate(6);
+    sierpinski.iterateParallel(6);
     
     TurtleRenderer renderer6(120.0f, 1.0f);
     renderer6.interpret(sierpinski.getString());
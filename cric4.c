@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include<string.h>
+#include <time.h>
 
 #define MAX_PLAYERS 11
+#define MAX_VALUE 255   // largest runs (or overs) a batch token may carry; Delivery keeps runs in a byte
 
 struct Player {
     char name[30];
@@ -17,6 +19,36 @@ struct Player players[11];
 int one=0;
 int two=1;
 
+// One delivery as written to the match log. Every field is a byte so the
+// record is a fixed 6 bytes and a log can be read back with plain fread.
+struct Delivery {
+    unsigned char innings;  // 1 or 2; 0 marks the start of a match
+    unsigned char extra;    // EXTRA_* below
+    unsigned char runs;     // runs entered for the ball; overs per side on a match start
+    unsigned char wicket;
+    unsigned char striker;  // index into players[]
+    unsigned char bowler;
+};
+enum { EXTRA_NONE, EXTRA_WIDE, EXTRA_NOBALL, EXTRA_LEGBYE, EXTRA_BYE };
+
+// Totals for one innings, rebuilt from the log by apply_delivery().
+struct Innings {
+    int score, wickets, balls, extras, wd, nb, lb, b, f, s;
+    int fow[11];            // score at the fall of each wicket, like c[] in main()
+    int runs[MAX_PLAYERS], faced[MAX_PLAYERS];
+};
+
+// A match being scored by batch_score().
+struct Match {
+    int number, overs, innings, target, finished;
+    int striker, non_striker, next_in;
+    struct Innings inn[2];
+};
+
+FILE *match_log=NULL;
+int innings=1;
+int bowler=0;
+
 // typedef struct PlayerNode {
 //     char name[18];
 //     int playerNumber,wkts,balls,maidens,overs;
@@ -118,6 +150,12 @@ float curr_rate(float a, float b, float c);
 void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i, int *j);
 int string_comp(char a[],char b[],char c[]);
 float curr_rate(float a, float b, float c);
+void open_log(const char *path,int t_overs);
+void log_delivery(int extra,int runs,int wicket,int striker);
+void apply_delivery(struct Innings *in,const struct Delivery *d);
+void print_innings(int n,const struct Innings *in);
+int replay_logs(int count,char *paths[]);
+int batch_score(const char *path,int every);
 
 int main(int argc, char *argv[]) {
 	int wd=0,nb=0,lb=0,b=0,extras=0,overs=0,T_overs=0, k=0,balls=0, T=0,score=0,wickets=0, target=0,q=0,c[11],j=1,f=0,s=0;
@@ -125,6 +163,14 @@ int main(int argc, char *argv[]) {
 	char toss[15], team_1[15], team_2[15], choice, runs;
 	// BowlerManager playerManager;
     initializePlayers();
+	if(argc>1&&strncmp(argv[1],"--",2)==0){
+		if(argc>2&&strcmp(argv[1],"--replay")==0)
+			return replay_logs(argc-2,argv+2);
+		if(argc>2&&strcmp(argv[1],"--batch")==0)
+			return batch_score(argv[2],argc>3?atoi(argv[3]):0);
+		printf("usage: %s [match.log]\n       %s --replay <log...>\n       %s --batch <file|-> [every]\n",argv[0],argv[0],argv[0]);
+		return 1;
+	}
 	printf("Match between:\n");
 	gets(team_1);
 	printf("versus\n");
@@ -135,6 +181,7 @@ int main(int argc, char *argv[]) {
 	scanf("%c",&choice);
 	printf("Enter overs to be played by each side: ");
 	scanf("%d",&T_overs);
+	open_log(argc>1?argv[1]:"match.log",T_overs);
 	system("cls");
 	T=string_comp(team_1,team_2,toss);
     // initializeBowlers(&playerManager);
@@ -227,6 +274,7 @@ int main(int argc, char *argv[]) {
 		sleep(1);
 	}
 	target=score+1,score=0,overs=0,k=0,wd=0,nb=0,lb=0,b=0,balls=0,wickets=0,extras=0,j=1,q=0,f=0,s=0;
+	innings=2;
 	while(overs<=T_overs||overs>=T_overs){
 		do{
 			if(wickets>q){
@@ -316,6 +364,9 @@ int main(int argc, char *argv[]) {
 		result(target,score,T,wickets,choice,team_1,team_2);
 		sleep(1);
 	}
+	if(match_log!=NULL){
+		fclose(match_log);
+	}
 	getche();
 	return 0;
 }
@@ -351,6 +402,7 @@ int string_comp(char a[],char b[],char c[]){
 void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,int *j){
 	char runs;
 	int t;
+	int striker=one;
 	scanf("%c",&runs);
 	switch(runs){
 		case '0':
@@ -360,6 +412,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                     updateScore(0,i,one,two);
                 }
             }
+			log_delivery(EXTRA_NONE,0,0,striker);
 			break;
 		case '1':
 			*b=*b+1;
@@ -370,6 +423,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                 }
                 break;
             }
+			log_delivery(EXTRA_NONE,1,0,striker);
 			break;
 		case '2':
 			*b=*b+2;
@@ -381,6 +435,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                                 break;
 
             }
+			log_delivery(EXTRA_NONE,2,0,striker);
 			break;
 		case '3':
 			*b=*b+3;
@@ -392,6 +447,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                                 break;
 
             }
+			log_delivery(EXTRA_NONE,3,0,striker);
 			break;
 		case '4':
 			*b=*b+4;
@@ -404,6 +460,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                                 break;
 
             }
+			log_delivery(EXTRA_NONE,4,0,striker);
 			break;
 		case '5':
 			*b=*b+5;
@@ -415,6 +472,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                                 break;
 
             }
+			log_delivery(EXTRA_NONE,5,0,striker);
 			break;
 		case '6':
 			*b=*b+6;
@@ -427,6 +485,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                                 break;
 
             }
+			log_delivery(EXTRA_NONE,6,0,striker);
 			break;
 		case 'w':
 		case 'W':
@@ -435,6 +494,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
 			*b=*b+1+t;
 			*d=*d+1+t;
 			*e=*e+1+t;
+			log_delivery(EXTRA_WIDE,t,0,striker);
 			break;
 		case 'n':
 		case 'N':
@@ -443,6 +503,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
 			*b=*b+t+1;
 			*d=*d+1;
 			*f=*f+1;
+			log_delivery(EXTRA_NOBALL,t,0,striker);
 			break;
 		case 'l':
 		case 'L':
@@ -452,6 +513,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
 			*a=*a+1;
 			*d=*d+t;
 			*g=*g+t;
+			log_delivery(EXTRA_LEGBYE,t,0,striker);
 			break;
 		case 'b':
 		case 'B':
@@ -461,6 +523,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
 			*a=*a+1;
 			*d=*d+t;
 			*h=*h+t;
+			log_delivery(EXTRA_BYE,t,0,striker);
 			break;
 		case 'o':
 		case 'O':
@@ -479,6 +542,7 @@ void ball_played(int *a,int *b,int *c,int *d,int *e,int *f,int *g,int *h,int *i,
                 two=two+1;
             }
             
+			log_delivery(EXTRA_NONE,t,1,striker);
 			break;
 	}
 }
@@ -542,4 +606,318 @@ void req_rate(float a, float b, float c,float d,float e){
 	i=b+(d/10);
 	g=f/(h-i);
 	printf("\t  req. run rate %0.2f\n",g);
-}
\ No newline at end of file
+}
+void open_log(const char *path,int t_overs){
+	struct Delivery start={0,EXTRA_NONE,0,0,0,0};
+	match_log=fopen(path,"ab");
+	if(match_log==NULL){
+		printf("cannot open %s, the match will not be logged\n",path);
+		return;
+	}
+	start.runs=(unsigned char)t_overs;
+	fwrite(&start,sizeof start,1,match_log);
+	fflush(match_log);
+}
+// Appends one delivery and flushes it, so a crash loses at most the ball
+// being entered.
+void log_delivery(int extra,int runs,int wicket,int striker){
+	struct Delivery d;
+	if(match_log==NULL)
+		return;
+	d.innings=(unsigned char)innings;
+	d.extra=(unsigned char)extra;
+	d.runs=(unsigned char)runs;
+	d.wicket=(unsigned char)wicket;
+	d.striker=(unsigned char)striker;
+	d.bowler=(unsigned char)bowler;
+	fwrite(&d,sizeof d,1,match_log);
+	fflush(match_log);
+}
+// Same totals ball_played() keeps in main()'s locals. Runs off the bat and
+// balls faced go to the striker for everything except wides.
+void apply_delivery(struct Innings *in,const struct Delivery *d){
+	int t=d->runs;
+	switch(d->extra){
+		case EXTRA_NONE:
+			in->score+=t;
+			in->balls++;
+			if(d->wicket){
+				in->wickets++;
+				if(in->wickets<=10)
+					in->fow[in->wickets]=in->score;
+			}
+			else if(t==4)
+				in->f++;
+			else if(t==6)
+				in->s++;
+			break;
+		case EXTRA_WIDE:
+			in->score+=1+t;
+			in->extras+=1+t;
+			in->wd+=1+t;
+			return;
+		case EXTRA_NOBALL:
+			in->score+=t+1;
+			in->extras++;
+			in->nb++;
+			break;
+		case EXTRA_LEGBYE:
+			in->score+=t;
+			in->balls++;
+			in->extras+=t;
+			in->lb+=t;
+			t=0;
+			break;
+		case EXTRA_BYE:
+			in->score+=t;
+			in->balls++;
+			in->extras+=t;
+			in->b+=t;
+			t=0;
+			break;
+	}
+	if(d->striker<MAX_PLAYERS){
+		in->runs[d->striker]+=t;
+		in->faced[d->striker]++;
+	}
+}
+void print_innings(int n,const struct Innings *in){
+	int j;
+	printf("innings %d: %d-%d\t\tovers %d.%d\n",n,in->score,in->wickets,in->balls/6,in->balls%6);
+	for(j=0;j<MAX_PLAYERS;j++){
+		if(in->faced[j])
+			printf("%s: Runs - %d, Balls Faced - %d\n",players[j].name,in->runs[j],in->faced[j]);
+	}
+	printf("extras: %d(wd %d,nb %d,lb %d,b %d)\tboundaries: %d fours,%d sixes\n",in->extras,in->wd,in->nb,in->lb,in->b,in->f,in->s);
+	if(in->wickets>0){
+		printf("fall of wickets:  ");
+		for(j=1;j<=in->wickets&&j<=10;j++){
+			if(j==1||j==6)
+			printf("\n");
+			else
+			printf("\t");
+			printf("%d-%d",j,in->fow[j]);
+		}
+		printf("\n");
+	}
+}
+// Rebuilds the scorecard of every match in the given logs. Records are read
+// a few thousand at a time and applied in one pass; a match ends at the next
+// match start or at the end of its file.
+int replay_logs(int count,char *paths[]){
+	static struct Delivery buf[4096];
+	struct Innings inn[2];
+	int i,k,n,overs=0,matches=0,started=0,failed=0;
+	long deliveries=0;
+	clock_t start=clock();
+	FILE *fp;
+	for(k=0;k<count;k++){
+		fp=fopen(paths[k],"rb");
+		if(fp==NULL){
+			printf("cannot open %s\n",paths[k]);
+			failed++;
+			continue;
+		}
+		while((n=(int)fread(buf,sizeof(struct Delivery),4096,fp))>0){
+			for(i=0;i<n;i++){
+				if(buf[i].innings==0||!started){
+					if(started){
+						printf("\nmatch %d (%d-overs)\n",matches,overs);
+						print_innings(1,&inn[0]);
+						print_innings(2,&inn[1]);
+					}
+					memset(inn,0,sizeof inn);
+					overs=buf[i].innings==0?buf[i].runs:0;
+					started=1;
+					matches++;
+					if(buf[i].innings==0)
+						continue;
+				}
+				if(buf[i].innings<=2){
+					apply_delivery(&inn[buf[i].innings-1],&buf[i]);
+					deliveries++;
+				}
+			}
+		}
+		fclose(fp);
+		if(started){
+			printf("\nmatch %d (%d-overs)\n",matches,overs);
+			print_innings(1,&inn[0]);
+			print_innings(2,&inn[1]);
+			started=0;
+		}
+	}
+	printf("\nreplayed %d matches (%ld deliveries) in %0.3f s\n",matches,deliveries,(double)(clock()-start)/CLOCKS_PER_SEC);
+	return failed?1:0;
+}
+void start_match(struct Match *m,int number,int overs){
+	memset(m,0,sizeof *m);
+	m->number=number;
+	m->overs=overs;
+	m->innings=1;
+	m->non_striker=1;
+	m->next_in=2;
+}
+void print_checkpoint(const struct Match *m){
+	const struct Innings *in=&m->inn[m->innings-1];
+	printf("match %d innings %d: %d-%d\tovers %d.%d\trun rate %0.2f",m->number,m->innings,
+		in->score,in->wickets,in->balls/6,in->balls%6,curr_rate(in->score,in->balls/6,in->balls%6));
+	if(m->innings==2)
+		printf("\t%d runs needed from %d balls",m->target-in->score,m->overs*6-in->balls);
+	printf("\n");
+}
+void finish_match(struct Match *m){
+	const struct Innings *first=&m->inn[0],*second=&m->inn[1];
+	printf("\nmatch %d (%d-overs)\n",m->number,m->overs);
+	print_innings(1,first);
+	print_innings(2,second);
+	if(m->innings<2)
+		printf("match abandoned in the first innings\n");
+	else if(second->score<m->target&&second->wickets<10&&second->balls<m->overs*6)
+		printf("second innings incomplete, no result\n");
+	else if(second->score>=m->target)
+		printf("chasing side won by %d wickets\n",10-second->wickets);
+	else if(second->score==m->target-1)
+		printf("MATCH DRAWN.\n");
+	else
+		printf("side batting first won by %d runs\n",m->target-1-second->score);
+	m->finished=1;
+}
+// Applies one delivery, rotates the strike and moves the match on to the
+// second innings or to its result. Prints the scoreboard after every
+// `every` overs.
+void score_delivery(struct Match *m,struct Delivery *d,int every){
+	struct Innings *in=&m->inn[m->innings-1];
+	int legal=d->extra!=EXTRA_WIDE&&d->extra!=EXTRA_NOBALL,t;
+	d->innings=(unsigned char)m->innings;
+	d->striker=(unsigned char)m->striker;
+	apply_delivery(in,d);
+	if(d->wicket){
+		m->striker=m->next_in++;
+	}
+	else if(d->runs%2==1){
+		t=m->striker;
+		m->striker=m->non_striker;
+		m->non_striker=t;
+	}
+	if(legal&&in->balls%6==0){
+		t=m->striker;
+		m->striker=m->non_striker;
+		m->non_striker=t;
+	}
+	if(in->balls>=m->overs*6||in->wickets==10||(m->innings==2&&in->score>=m->target)){
+		if(m->innings==1){
+			m->innings=2;
+			m->target=in->score+1;
+			m->striker=0;
+			m->non_striker=1;
+			m->next_in=2;
+		}
+		else
+			finish_match(m);
+	}
+	else if(every>0&&legal&&in->balls%(6*every)==0)
+		print_checkpoint(m);
+}
+// Scores deliveries written in the same notation as the prompt: '0'-'6' for
+// runs off the bat, w, n, l, b or o followed by the runs on a wide, no ball,
+// leg bye, bye or run out, and m followed by the overs per side to start a
+// match. Anything else is skipped and '#' starts a comment. The input is read
+// 64 KB at a time, so a whole season scores without any per-ball I/O. A match
+// of no overs or a value over MAX_VALUE is reported with its line and skipped;
+// deliveries after a rejected match start are ignored until the next one.
+int batch_score(const char *path,int every){
+	static char buf[1<<16];
+	struct Match m;
+	struct Delivery d={0,EXTRA_NONE,0,0,0,0};
+	int i,n,c,pending=0,value=0,digits=0,comment=0,matches=0,started=0,line=1,token_line=1,rejected=0;
+	long deliveries=0,ignored=0;
+	clock_t start=clock();
+	FILE *fp=strcmp(path,"-")==0?stdin:fopen(path,"rb");
+	if(fp==NULL){
+		printf("cannot open %s\n",path);
+		return 1;
+	}
+	for(;;){
+		n=(int)fread(buf,1,sizeof buf,fp);
+		// An empty read runs the loop once more with EOF to flush the last token.
+		for(i=0;i<(n>0?n:1);i++){
+			c=n>0?(unsigned char)buf[i]:EOF;
+			if(c=='\n')
+				line++;
+			if(comment){
+				comment=c!='\n';
+				continue;
+			}
+			if(pending){
+				if(c>='0'&&c<='9'){
+					if(value<=MAX_VALUE)
+						value=value*10+c-'0';
+					digits=1;
+					continue;
+				}
+				if(!digits&&(c==' '||c=='\t'||c=='\r'||c=='\n'))
+					continue;
+				if(pending=='m'){
+					if(started&&!m.finished)
+						finish_match(&m);
+					started=value>0&&value<=MAX_VALUE;
+					if(started)
+						start_match(&m,++matches,value);
+					else{
+						printf("line %d: a match needs 1 to %d overs per side\n",token_line,MAX_VALUE);
+						rejected++;
+					}
+				}
+				else if(value>MAX_VALUE){
+					printf("line %d: more than %d runs on one ball\n",token_line,MAX_VALUE);
+					rejected++;
+				}
+				else{
+					d.extra=pending=='w'?EXTRA_WIDE:pending=='n'?EXTRA_NOBALL:pending=='l'?EXTRA_LEGBYE:pending=='b'?EXTRA_BYE:EXTRA_NONE;
+					d.runs=(unsigned char)value;
+					d.wicket=pending=='o';
+					if(started&&!m.finished){
+						score_delivery(&m,&d,every);
+						deliveries++;
+					}
+					else
+						ignored++;
+				}
+				pending=0;
+			}
+			if(c>='0'&&c<='6'){
+				d.extra=EXTRA_NONE;
+				d.runs=(unsigned char)(c-'0');
+				d.wicket=0;
+				if(started&&!m.finished){
+					score_delivery(&m,&d,every);
+					deliveries++;
+				}
+				else
+					ignored++;
+			}
+			else if(c=='#')
+				comment=1;
+			else if(c!=EOF&&strchr("wWnNlLbBoOmM",c)!=NULL){
+				pending=c|0x20;
+				value=0;
+				digits=0;
+				token_line=line;
+			}
+		}
+		if(n==0)
+			break;
+	}
+	if(fp!=stdin)
+		fclose(fp);
+	if(started&&!m.finished)
+		finish_match(&m);
+	printf("\nscored %d matches (%ld deliveries) in %0.3f s",matches,deliveries,(double)(clock()-start)/CLOCKS_PER_SEC);
+	if(ignored>0)
+		printf(", %ld deliveries outside a match ignored",ignored);
+	if(rejected>0)
+		printf(", %d bad entries skipped",rejected);
+	printf("\n");
+	return rejected?1:0;
+}
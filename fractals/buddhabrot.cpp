@@ -0,0 +1,258 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <omp.h>
+#include "fractal.h"
+
+// Buddhabrot / Nebulabrot: instead of colouring c by its escape time, every
+// escaping orbit z_1..z_n is splatted into a density histogram.
+//
+// Starting points are sampled with Metropolis-Hastings (small jumps around a
+// point whose orbit crosses the view, plus occasional uniform jumps), and each
+// sample is weighted by 1/contribution so the image matches plain uniform
+// sampling at a fraction of the cost. Chains are seeded from the chain index
+// and every thread accumulates into its own fixed-point histogram; integer
+// merges are order independent, so the output is identical for any thread
+// count.
+//
+// Usage: buddhabrot [--size WxH] [--samples N] [--chains N] [--seed N]
+//                   [--iter N] [--min-iter N] [--nebula] [--uniform] [--out file.ppm]
+
+struct BuddhaConfig {
+    int width = 800, height = 800;
+    Viewport view = {-2.0L, 1.0L, -1.5L, 1.5L, 800, 800};
+    long long samples = 2000000;   // orbits evaluated, all chains together
+    int chains = 64;
+    uint64_t seed = 1;
+    int min_iter = 20;
+    int max_iter[3] = {1000, 1000, 1000};  // per channel; equal for plain Buddhabrot
+    bool uniform = false;
+    std::string out = "buddhabrot.ppm";
+};
+
+// Fixed-point scale for histogram weights.
+static const double weight_scale = 65536.0;
+
+// splitmix64: small, deterministic, and good enough to seed per-chain streams.
+struct Rng {
+    uint64_t state;
+    explicit Rng(uint64_t s) : state(s) {}
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+// Points in the main cardioid or the period-2 bulb never escape.
+static bool inMainBulbs(double cr, double ci) {
+    double q = (cr - 0.25) * (cr - 0.25) + ci * ci;
+    if (q * (q + (cr - 0.25)) <= 0.25 * ci * ci) return true;
+    return (cr + 1.0) * (cr + 1.0) + ci * ci <= 0.0625;
+}
+
+struct Orbit {
+    std::vector<int> hits;  // histogram pixel of every orbit point inside the view
+    int iter = 0;           // escape iteration, or 0 if it never escaped
+    int channels = 0;       // bit k set if channel k accepts this orbit
+
+    double contribution() const { return channels ? (double)hits.size() : 0.0; }
+};
+
+static void traceOrbit(const BuddhaConfig& cfg, double cr, double ci, int longest, Orbit& o) {
+    o.hits.clear();
+    o.iter = 0;
+    o.channels = 0;
+    if (inMainBulbs(cr, ci)) return;
+
+    const double sx = cfg.width / double(cfg.view.x_max - cfg.view.x_min);
+    const double sy = cfg.height / double(cfg.view.y_max - cfg.view.y_min);
+    const double x0 = double(cfg.view.x_min), y0 = double(cfg.view.y_min);
+
+    double zx = 0.0, zy = 0.0;
+    int iter = 0;
+    while (zx * zx + zy * zy <= 4.0 && iter < longest) {
+        MandelbrotStep::apply(zx, zy, cr, ci);
+        iter++;
+        int px = (int)std::floor((zx - x0) * sx);
+        int py = (int)std::floor((zy - y0) * sy);
+        if (px >= 0 && px < cfg.width && py >= 0 && py < cfg.height)
+            o.hits.push_back(py * cfg.width + px);
+    }
+    if (zx * zx + zy * zy <= 4.0 || iter < cfg.min_iter) {
+        o.hits.clear();
+        return;
+    }
+    o.iter = iter;
+    for (int k = 0; k < 3; ++k)
+        if (iter < cfg.max_iter[k]) o.channels |= 1 << k;
+}
+
+static void splat(const Orbit& o, double weight, int pixels, uint64_t* hist) {
+    uint64_t w = (uint64_t)std::llround(weight * weight_scale);
+    for (int k = 0; k < 3; ++k) {
+        if (!(o.channels & (1 << k))) continue;
+        uint64_t* channel = hist + (size_t)k * pixels;
+        for (int p : o.hits) channel[p] += w;
+    }
+}
+
+static void runChain(const BuddhaConfig& cfg, int chain, long long steps, uint64_t* hist) {
+    const int pixels = cfg.width * cfg.height;
+    const int longest = *std::max_element(cfg.max_iter, cfg.max_iter + 3);
+    Rng rng(cfg.seed * 0x100000001B3ULL + (uint64_t)chain);
+
+    Orbit current, proposal;
+    current.hits.reserve(longest);
+    proposal.hits.reserve(longest);
+
+    auto randomPoint = [&](double& cr, double& ci) {
+        cr = -2.0 + 4.0 * rng.uniform();
+        ci = -2.0 + 4.0 * rng.uniform();
+    };
+
+    if (cfg.uniform) {
+        for (long long s = 0; s < steps; ++s) {
+            double cr, ci;
+            randomPoint(cr, ci);
+            traceOrbit(cfg, cr, ci, longest, current);
+            if (current.contribution() > 0) splat(current, 1.0, pixels, hist);
+        }
+        return;
+    }
+
+    // Find a starting point whose orbit actually crosses the view.
+    double cr = 0, ci = 0;
+    for (int tries = 0; tries < 1000000 && current.contribution() == 0; ++tries) {
+        randomPoint(cr, ci);
+        traceOrbit(cfg, cr, ci, longest, current);
+    }
+    if (current.contribution() == 0) return;
+
+    const double view_span = double(cfg.view.x_max - cfg.view.x_min);
+    const double r_min = 1e-4 * view_span, r_max = 0.1 * view_span;
+    for (long long s = 0; s < steps; ++s) {
+        double nr, ni;
+        if (rng.uniform() < 0.2) {
+            randomPoint(nr, ni);
+        } else {
+            double r = r_max * std::exp(std::log(r_min / r_max) * rng.uniform());
+            double phi = 2.0 * M_PI * rng.uniform();
+            nr = cr + r * std::cos(phi);
+            ni = ci + r * std::sin(phi);
+        }
+        traceOrbit(cfg, nr, ni, longest, proposal);
+
+        // Both mutations are symmetric, so the acceptance ratio is just the
+        // ratio of contributions.
+        double f_new = proposal.contribution(), f_old = current.contribution();
+        if (f_new > 0 && rng.uniform() * f_old < f_new) {
+            std::swap(current, proposal);
+            cr = nr;
+            ci = ni;
+        }
+        splat(current, 1.0 / current.contribution(), pixels, hist);
+    }
+}
+
+static bool parseArgs(int argc, char* argv[], BuddhaConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--nebula") {
+            cfg.max_iter[0] = 5000;
+            cfg.max_iter[1] = 500;
+            cfg.max_iter[2] = 50;
+            cfg.min_iter = 1;
+            continue;
+        }
+        if (arg == "--uniform") {
+            cfg.uniform = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if (arg == "--size")
+            ok = std::sscanf(value, "%dx%d", &cfg.width, &cfg.height) == 2 && cfg.width > 0 && cfg.height > 0;
+        else if (arg == "--samples") ok = std::sscanf(value, "%lld", &cfg.samples) == 1 && cfg.samples > 0;
+        else if (arg == "--chains") ok = std::sscanf(value, "%d", &cfg.chains) == 1 && cfg.chains > 0;
+        else if (arg == "--seed") ok = std::sscanf(value, "%llu", (unsigned long long*)&cfg.seed) == 1;
+        else if (arg == "--min-iter") ok = std::sscanf(value, "%d", &cfg.min_iter) == 1;
+        else if (arg == "--iter") {
+            ok = std::sscanf(value, "%d", &cfg.max_iter[0]) == 1 && cfg.max_iter[0] > 0;
+            cfg.max_iter[1] = cfg.max_iter[2] = cfg.max_iter[0];
+        }
+        else if (arg == "--out") cfg.out = value;
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+        if (!ok) {
+            std::cerr << "Bad value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+    cfg.view.width = cfg.width;
+    cfg.view.height = cfg.height;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BuddhaConfig cfg;
+    if (!parseArgs(argc, argv, cfg)) return 1;
+
+    const int pixels = cfg.width * cfg.height;
+    const int threads = omp_get_max_threads();
+    std::vector<std::vector<uint64_t>> local(threads);
+
+    double t0 = omp_get_wtime();
+    #pragma omp parallel
+    {
+        std::vector<uint64_t>& hist = local[omp_get_thread_num()];
+        hist.assign((size_t)pixels * 3, 0);
+        #pragma omp for schedule(dynamic, 1)
+        for (int chain = 0; chain < cfg.chains; ++chain) {
+            long long steps = cfg.samples / cfg.chains + (chain < cfg.samples % cfg.chains);
+            runChain(cfg, chain, steps, hist.data());
+        }
+    }
+
+    // Merge the per-thread histograms.
+    std::vector<uint64_t> hist((size_t)pixels * 3, 0);
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < (long long)hist.size(); ++i)
+        for (int t = 0; t < threads; ++t)
+            hist[i] += local[t][i];
+    double seconds = omp_get_wtime() - t0;
+
+    // Tone map each channel against its own brightest pixel.
+    std::vector<unsigned char> image((size_t)pixels * 3);
+    for (int k = 0; k < 3; ++k) {
+        const uint64_t* channel = hist.data() + (size_t)k * pixels;
+        uint64_t peak = *std::max_element(channel, channel + pixels);
+        for (int p = 0; p < pixels; ++p) {
+            double v = peak ? std::sqrt(double(channel[p]) / peak) : 0.0;
+            image[(size_t)p * 3 + k] = (unsigned char)std::min(255.0, 255.0 * v);
+        }
+    }
+    std::ofstream img(cfg.out, std::ios::binary);
+    img << "P6\n" << cfg.width << " " << cfg.height << "\n255\n";
+    img.write((const char*)image.data(), image.size());
+
+    uint64_t checksum = 1469598103934665603ULL;
+    for (uint64_t v : hist) checksum = (checksum ^ v) * 1099511628211ULL;
+    std::cout << cfg.samples << " orbits in " << seconds << " s ("
+              << cfg.samples / seconds / 1e6 << " M orbits/s), histogram checksum "
+              << std::hex << checksum << std::dec << std::endl;
+    return 0;
+}
@@ -5,61 +5,11 @@
 #include <cmath>
 #include <omp.h>
 #include <vector>
+#include <string>
+#include "../fractal.h"
 
-struct Color {
-    int r, g, b;
-    Color(int r = 0, int g = 0, int b = 0) : r(r), g(g), b(b) {}
-};
-
-Color getColor(int iter, int max_iter, double smooth_iter) {
-    if (iter == max_iter) return Color(0, 0, 0); 
-
-    double t = (iter + 1 - smooth_iter) / max_iter;
-    t = std::pow(t, 0.5);
-    if (t < 0.16) {
-        // Deep red to orange
-        double local_t = t / 0.16;
-        return Color(
-            (int)(50 + 155 * local_t),
-            (int)(10 + 40 * local_t),
-            (int)(5 + 10 * local_t)
-        );
-    } else if (t < 0.42) {
-        // Orange to bright yellow
-        double local_t = (t - 0.16) / 0.26;
-        return Color(
-            (int)(205 + 50 * local_t),
-            (int)(50 + 155 * local_t),
-            (int)(15 + 25 * local_t)
-        );
-    } else if (t < 0.64) {
-        // Yellow to white hot
-        double local_t = (t - 0.42) / 0.22;
-        return Color(
-            255,
-            (int)(205 + 50 * local_t),
-            (int)(40 + 115 * local_t)
-        );
-    } else if (t < 0.86) {
-        // White to pale blue
-        double local_t = (t - 0.64) / 0.22;
-        return Color(
-            (int)(255 - 55 * local_t),
-            (int)(255 - 55 * local_t),
-            (int)(155 + 100 * local_t)
-        );
-    } else {
-        // Pale blue to deep blue
-        double local_t = (t - 0.86) / 0.14;
-        return Color(
-            (int)(200 - 150 * local_t),
-            (int)(200 - 150 * local_t),
-            255
-        );
-    }
-}
-
-int main() {
+// Usage: burning_ship [--precision auto|float|double|long] [--validate]
+int main(int argc, char* argv[]) {
     const int width = 1200; 
     const int height = 900;
     const int max_iter = 2000;  
@@ -68,36 +18,45 @@ int main() {
     const double x_max = 1.0;
     const double y_min = -1.5;
     const double y_max = 1.0;
+
+    const Viewport view = {x_min, x_max, y_min, y_max, width, height};
+
+    bool validate = false;
+    Precision precision = selectPrecision(view, max_iter);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--validate") {
+            validate = true;
+        } else if (arg == "--precision" && i + 1 < argc) {
+            std::string p = argv[++i];
+            if (p != "auto" && !parsePrecision(p, precision)) {
+                std::cerr << "Unknown precision: " << p << std::endl;
+                return 1;
+            }
+        }
+    }
     
     std::ofstream img("burning_ship_enhanced.ppm");
     img << "P3\n" << width << " " << height << "\n255\n";
 
+    std::vector<int> iters((size_t)width * height);
+    std::vector<double> norms((size_t)width * height);
+    renderEscape<BurningShipStep>(precision, view, max_iter, 256.0, iters.data(), norms.data());
+
+    if (validate) {
+        std::vector<int> reference((size_t)width * height);
+        renderEscape<BurningShipStep>(Precision::Double, view, max_iter, 256.0, reference.data());
+        std::cout << "Pixels differing from double reference: "
+                  << 100.0 * mismatchRatio(iters, reference) << "%" << std::endl;
+    }
+
     std::vector<std::vector<Color>> buffer(height, std::vector<Color>(width));
     
     #pragma omp parallel for schedule(dynamic, 1)
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            // Map pixel to complex plane with better scaling
-            double real = x_min + (x * (x_max - x_min)) / width;
-            double imag = y_min + (y * (y_max - y_min)) / height;
-            
-            double zx = 0.0, zy = 0.0;
-            int iter = 0;
-
-            while (zx * zx + zy * zy <= 256.0 && iter < max_iter) {  
-                double zx_new = zx * zx - zy * zy + real;
-                double zy_new = std::abs(2.0 * zx * zy) + imag;  
-                zx = std::abs(zx_new);  // abs() on real part too
-                zy = zy_new;
-                iter++;
-            }
-
-            double smooth_iter = 0.0;
-            if (iter < max_iter) {
-                double log_zn = std::log(zx * zx + zy * zy) / 2.0;
-                double nu = std::log(log_zn / std::log(2.0)) / std::log(2.0);
-                smooth_iter = nu;
-            }
+            int iter = iters[(size_t)y * width + x];
+            double smooth_iter = smoothTerm(iter, max_iter, norms[(size_t)y * width + x]);
             
             buffer[y][x] = getColor(iter, max_iter, smooth_iter);
         }
@@ -110,7 +69,8 @@ int main() {
     }
     
     img.close();
-    std::cout << "Resolution: " << width << "x" << height << ", Max iterations: " << max_iter << std::endl;
+    std::cout << "Resolution: " << width << "x" << height << ", Max iterations: " << max_iter
+              << ", Precision: " << precisionName(precision) << std::endl;
     
     return 0;
 }
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+// Escape-time kernels shared by the fractal programs. Every kernel is templated
+// on the scalar type so the same loop runs in float, double or long double.
+
+enum class Precision { Float, Double, LongDouble };
+
+inline const char* precisionName(Precision p) {
+    switch (p) {
+        case Precision::Float: return "float";
+        case Precision::Double: return "double";
+        default: return "long double";
+    }
+}
+
+inline bool parsePrecision(const std::string& s, Precision& out) {
+    if (s == "float") out = Precision::Float;
+    else if (s == "double") out = Precision::Double;
+    else if (s == "long" || s == "longdouble") out = Precision::LongDouble;
+    else return false;
+    return true;
+}
+
+// Region of the complex plane mapped onto a width x height pixel grid.
+// Bounds are kept in long double so deep zooms survive until the kernel picks
+// its own precision.
+struct Viewport {
+    long double x_min, x_max, y_min, y_max;
+    int width, height;
+};
+
+struct MandelbrotStep {
+    template<typename T>
+    static void apply(T& zx, T& zy, T cr, T ci) {
+        T zx_new = zx * zx - zy * zy + cr;
+        zy = 2 * zx * zy + ci;
+        zx = zx_new;
+    }
+};
+
+struct BurningShipStep {
+    template<typename T>
+    static void apply(T& zx, T& zy, T cr, T ci) {
+        T zx_new = zx * zx - zy * zy + cr;
+        T zy_new = std::abs(2 * zx * zy) + ci;
+        zx = std::abs(zx_new);  // abs() on real part too
+        zy = zy_new;
+    }
+};
+
+// Number of pixels iterated side by side; 32 bytes of lanes fills an AVX register.
+template<typename T>
+constexpr int laneCount() { return sizeof(T) <= 8 ? int(32 / sizeof(T)) : 1; }
+
+// Integer type with the width of T, used to blend lanes with bit masks. GCC
+// will not if-convert a floating-point select inside the lane loop, but it
+// does vectorize the equivalent and/or on the raw bits.
+template<typename T> struct LaneBits;
+template<> struct LaneBits<float> { using type = int32_t; };
+template<> struct LaneBits<double> { using type = int64_t; };
+
+// Iterates one block of lanes. Lanes that have left the bailout radius are
+// frozen, so iters[] and the final z match the scalar while-loop exactly.
+template<typename Step, typename T, int L>
+inline void escapeBlock(T (&zx)[L], T (&zy)[L], const T (&cr)[L], const T (&ci)[L],
+                        int max_iter, T bailout, int (&iters)[L]) {
+    if constexpr (sizeof(T) > 8) {
+        // No vector unit handles long double; plain scalar loop.
+        for (int l = 0; l < L; ++l) {
+            int iter = 0;
+            while (zx[l] * zx[l] + zy[l] * zy[l] <= bailout && iter < max_iter) {
+                Step::apply(zx[l], zy[l], cr[l], ci[l]);
+                iter++;
+            }
+            iters[l] = iter;
+        }
+    } else {
+        using Bits = typename LaneBits<T>::type;
+        Bits count[L] = {};
+        for (int k = 0; k < max_iter; ++k) {
+            Bits active = 0;
+            for (int l = 0; l < L; ++l) {
+                T x = zx[l], y = zy[l];
+                T nx = x, ny = y;
+                Step::apply(nx, ny, cr[l], ci[l]);
+                Bits m = -(Bits)(x * x + y * y <= bailout);
+                Bits bx, by, bnx, bny;
+                std::memcpy(&bx, &x, sizeof(T));
+                std::memcpy(&by, &y, sizeof(T));
+                std::memcpy(&bnx, &nx, sizeof(T));
+                std::memcpy(&bny, &ny, sizeof(T));
+                bx = (bnx & m) | (bx & ~m);
+                by = (bny & m) | (by & ~m);
+                std::memcpy(&zx[l], &bx, sizeof(T));
+                std::memcpy(&zy[l], &by, sizeof(T));
+                count[l] -= m;
+                active |= m;
+            }
+            if (!active) break;
+        }
+        for (int l = 0; l < L; ++l) iters[l] = int(count[l]);
+    }
+}
+
+// Renders iteration counts (and optionally |z|^2 at escape, for smoothing)
+// for every pixel of the viewport in precision T.
+template<typename Step, typename T>
+void renderEscape(const Viewport& v, int max_iter, T bailout,
+                  int* iters, double* norms = nullptr) {
+    constexpr int L = laneCount<T>();
+    std::vector<T> col_re(v.width);
+    for (int x = 0; x < v.width; ++x)
+        col_re[x] = T(v.x_min + x * (v.x_max - v.x_min) / v.width);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int y = 0; y < v.height; ++y) {
+        T imag = T(v.y_min + y * (v.y_max - v.y_min) / v.height);
+        int* row_iters = iters + (size_t)y * v.width;
+        for (int x0 = 0; x0 < v.width; x0 += L) {
+            int n = std::min(L, v.width - x0);
+            T zx[L] = {}, zy[L] = {}, cr[L], ci[L];
+            int it[L];
+            for (int l = 0; l < L; ++l) {
+                // Pad the tail with a real pixel so idle lanes escape with it.
+                cr[l] = col_re[x0 + std::min(l, n - 1)];
+                ci[l] = imag;
+            }
+            escapeBlock<Step>(zx, zy, cr, ci, max_iter, bailout, it);
+            for (int l = 0; l < n; ++l) {
+                row_iters[x0 + l] = it[l];
+                if (norms)
+                    norms[(size_t)y * v.width + x0 + l] = double(zx[l] * zx[l] + zy[l] * zy[l]);
+            }
+        }
+    }
+}
+
+// Picks the cheapest type whose rounding error stays well below the pixel
+// spacing. Orbits live around |z| ~ 2, so the magnitude is never taken smaller
+// than that, and rounding error compounds roughly linearly with iterations.
+inline Precision selectPrecision(const Viewport& v, int max_iter) {
+    const long double safety = 16.0L * std::max(max_iter, 1);
+    long double spacing = std::min((v.x_max - v.x_min) / v.width,
+                                   (v.y_max - v.y_min) / v.height);
+    long double magnitude = std::max({std::fabs(v.x_min), std::fabs(v.x_max),
+                                      std::fabs(v.y_min), std::fabs(v.y_max), 2.0L});
+    long double relative = spacing / magnitude;
+    if (relative > safety * FLT_EPSILON) return Precision::Float;
+    if (relative > safety * DBL_EPSILON) return Precision::Double;
+    return Precision::LongDouble;
+}
+
+template<typename Step>
+void renderEscape(Precision p, const Viewport& v, int max_iter, double bailout,
+                  int* iters, double* norms = nullptr) {
+    switch (p) {
+        case Precision::Float:
+            renderEscape<Step, float>(v, max_iter, float(bailout), iters, norms);
+            break;
+        case Precision::Double:
+            renderEscape<Step, double>(v, max_iter, bailout, iters, norms);
+            break;
+        default:
+            renderEscape<Step, long double>(v, max_iter, (long double)bailout, iters, norms);
+            break;
+    }
+}
+
+enum class Formula { Mandelbrot, BurningShip };
+
+inline double defaultBailout(Formula f) { return f == Formula::Mandelbrot ? 4.0 : 256.0; }
+
+inline void renderEscape(Formula f, Precision p, const Viewport& v, int max_iter,
+                         int* iters, double* norms = nullptr) {
+    if (f == Formula::Mandelbrot)
+        renderEscape<MandelbrotStep>(p, v, max_iter, defaultBailout(f), iters, norms);
+    else
+        renderEscape<BurningShipStep>(p, v, max_iter, defaultBailout(f), iters, norms);
+}
+
+// Share of pixels whose iteration count differs from the reference buffer.
+inline double mismatchRatio(const std::vector<int>& a, const std::vector<int>& ref) {
+    size_t diff = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+        diff += a[i] != ref[i];
+    return a.empty() ? 0.0 : double(diff) / a.size();
+}
+
+// Palettes. Each maps an escape count (plus the smoothing term for the
+// continuous palettes) to an 8-bit colour.
+
+struct Color {
+    int r, g, b;
+    Color(int r = 0, int g = 0, int b = 0) : r(r), g(g), b(b) {}
+};
+
+inline Color getColor(int iter, int max_iter, double smooth_iter) {
+    if (iter == max_iter) return Color(0, 0, 0); 
+
+    double t = (iter + 1 - smooth_iter) / max_iter;
+    t = std::pow(t, 0.5);
+    if (t < 0.16) {
+        // Deep red to orange
+        double local_t = t / 0.16;
+        return Color(
+            (int)(50 + 155 * local_t),
+            (int)(10 + 40 * local_t),
+            (int)(5 + 10 * local_t)
+        );
+    } else if (t < 0.42) {
+        // Orange to bright yellow
+        double local_t = (t - 0.16) / 0.26;
+        return Color(
+            (int)(205 + 50 * local_t),
+            (int)(50 + 155 * local_t),
+            (int)(15 + 25 * local_t)
+        );
+    } else if (t < 0.64) {
+        // Yellow to white hot
+        double local_t = (t - 0.42) / 0.22;
+        return Color(
+            255,
+            (int)(205 + 50 * local_t),
+            (int)(40 + 115 * local_t)
+        );
+    } else if (t < 0.86) {
+        // White to pale blue
+        double local_t = (t - 0.64) / 0.22;
+        return Color(
+            (int)(255 - 55 * local_t),
+            (int)(255 - 55 * local_t),
+            (int)(155 + 100 * local_t)
+        );
+    } else {
+        // Pale blue to deep blue
+        double local_t = (t - 0.86) / 0.14;
+        return Color(
+            (int)(200 - 150 * local_t),
+            (int)(200 - 150 * local_t),
+            255
+        );
+    }
+}
+
+// mandelbrot.cpp's original single-channel ramp.
+inline Color redColor(int iter, int max_iter) {
+    return Color(255 * iter / max_iter, 0, 0);
+}
+
+inline Color grayColor(int iter, int max_iter, double smooth_iter) {
+    if (iter == max_iter) return Color(0, 0, 0);
+    double t = std::min(1.0, std::max(0.0, (iter + 1 - smooth_iter) / max_iter));
+    int v = (int)(255 * std::sqrt(t));
+    return Color(v, v, v);
+}
+
+// Continuous-iteration correction for a pixel that escaped with |z|^2 = norm.
+inline double smoothTerm(int iter, int max_iter, double norm) {
+    if (iter >= max_iter) return 0.0;
+    double log_zn = std::log(norm) / 2.0;
+    return std::log(log_zn / std::log(2.0)) / std::log(2.0);
+}
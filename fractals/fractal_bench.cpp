@@ -0,0 +1,118 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <omp.h>
+#include "fractal.h"
+
+// Fixed reference scenes for timing the escape-time kernels. Scenes, sizes and
+// iteration limits never change, so the checksums are comparable across runs:
+// a changed checksum means the rendered image changed, not just its speed.
+//
+// Usage: fractal_bench [--quick] [--precision float|double|long]
+
+struct Scene {
+    const char* name;
+    Formula formula;
+    long double center_x, center_y, span_x;
+    int width, height, max_iter;
+};
+
+static const Scene scenes[] = {
+    {"full view",        Formula::Mandelbrot,  -0.75L,  0.0L,  3.5L,   1024, 768, 256},
+    {"seahorse valley",  Formula::Mandelbrot,  -0.7436L, 0.1318L, 0.02L, 1024, 768, 2000},
+    {"interior heavy",   Formula::Mandelbrot,  -0.2L,   0.0L,  0.8L,   1024, 768, 1000},
+    {"deep zoom",        Formula::Mandelbrot,  -0.743643887037151L, 0.131825904205330L, 4e-10L,
+                                                                        512,  384, 4000},
+    {"burning ship bow", Formula::BurningShip, -1.762L, -0.028L, 0.045L, 1024, 768, 1000},
+};
+
+static Viewport sceneViewport(const Scene& s) {
+    long double span_y = s.span_x * s.height / s.width;
+    return {s.center_x - s.span_x / 2, s.center_x + s.span_x / 2,
+            s.center_y - span_y / 2, s.center_y + span_y / 2, s.width, s.height};
+}
+
+static void renderScene(const Scene& s, Precision p, std::vector<int>& iters) {
+    renderEscape(s.formula, p, sceneViewport(s), s.max_iter, iters.data());
+}
+
+// FNV-1a over the iteration buffer.
+static uint64_t checksum(const std::vector<int>& iters) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int it : iters) {
+        for (int b = 0; b < 4; ++b) {
+            h ^= (uint64_t)((it >> (8 * b)) & 0xff);
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+int main(int argc, char* argv[]) {
+    bool quick = false;
+    bool force_precision = false;
+    Precision forced = Precision::Double;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--precision" && i + 1 < argc) {
+            if (!parsePrecision(argv[++i], forced)) {
+                std::cerr << "Unknown precision: " << argv[i] << std::endl;
+                return 1;
+            }
+            force_precision = true;
+        }
+    }
+
+    const int max_threads = omp_get_max_threads();
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+    if (quick) thread_counts = {max_threads};
+
+    std::cout << std::left << std::setw(18) << "scene" << std::setw(13) << "precision"
+              << std::right << std::setw(8) << "threads" << std::setw(10) << "seconds"
+              << std::setw(10) << "Mpix/s" << std::setw(12) << "Giter/s"
+              << std::setw(10) << "speedup" << "  checksum\n";
+
+    for (const Scene& s : scenes) {
+        Precision p = force_precision ? forced : selectPrecision(sceneViewport(s), s.max_iter);
+        std::vector<int> iters((size_t)s.width * s.height);
+        renderScene(s, p, iters);  // warm-up, also faults in the buffer
+
+        long long total_iter = 0;
+        for (int it : iters) total_iter += it;
+        uint64_t sum = checksum(iters);
+
+        double base_seconds = 0.0;
+        for (int threads : thread_counts) {
+            omp_set_num_threads(threads);
+            const int reps = quick ? 1 : 3;
+            double best = 1e30;
+            for (int r = 0; r < reps; ++r) {
+                double t0 = omp_get_wtime();
+                renderScene(s, p, iters);
+                best = std::min(best, omp_get_wtime() - t0);
+            }
+            if (checksum(iters) != sum) {
+                std::cerr << s.name << ": checksum changed with " << threads << " threads\n";
+                return 1;
+            }
+            if (base_seconds == 0.0) base_seconds = best;
+
+            std::cout << std::left << std::setw(18) << s.name << std::setw(13) << precisionName(p)
+                      << std::right << std::setw(8) << threads
+                      << std::setw(10) << std::fixed << std::setprecision(4) << best
+                      << std::setw(10) << std::setprecision(2) << s.width * (double)s.height / best / 1e6
+                      << std::setw(12) << std::setprecision(3) << total_iter / best / 1e9
+                      << std::setw(10) << std::setprecision(2) << base_seconds / best
+                      << "  " << std::hex << std::setw(16) << std::setfill('0') << sum
+                      << std::dec << std::setfill(' ') << "\n";
+        }
+    }
+    omp_set_num_threads(max_threads);
+    return 0;
+}
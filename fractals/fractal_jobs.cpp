@@ -0,0 +1,217 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <omp.h>
+#include "fractal.h"
+
+// Batch renderer: reads render jobs from a file (or stdin with "-") and runs
+// them one after another in one process. Every job reuses the same OpenMP
+// thread pool and the same pixel buffers, which only grow when a job is larger
+// than anything rendered before it.
+//
+// One job per line, whitespace-separated key=value pairs, '#' starts a comment:
+//
+//   formula=mandelbrot view=-2,2,-2,2 size=800x600 iter=100 palette=red out=mandelbrot.ppm
+//   formula=burningship center=-1.762,-0.028 span=0.045 size=1200x900 iter=1000 palette=fire out=bow.ppm
+//
+// Keys: formula (mandelbrot|burningship), view (x_min,x_max,y_min,y_max) or
+// center (x,y) with span (width on the real axis), size (WxH), iter,
+// palette (red|fire|gray), precision (auto|float|double|long), out.
+// A single job can also be given directly as arguments:
+//
+//   fractal_jobs formula=mandelbrot size=1920x1080 out=big.ppm
+
+enum class Palette { Red, Fire, Gray };
+
+struct Job {
+    Formula formula = Formula::Mandelbrot;
+    Viewport view = {-2.0L, 2.0L, -2.0L, 2.0L, 800, 600};
+    int max_iter = 100;
+    Palette palette = Palette::Red;
+    bool auto_precision = true;
+    Precision precision = Precision::Double;
+    std::string output;
+};
+
+// Buffers kept alive across jobs.
+struct RenderBuffers {
+    std::vector<int> iters;
+    std::vector<double> norms;
+    std::vector<unsigned char> pixels;
+
+    void reserve(size_t count) {
+        iters.resize(count);
+        norms.resize(count);
+        pixels.resize(count * 3);
+    }
+};
+
+static bool parseJob(const std::vector<std::string>& tokens, Job& job, std::string& error) {
+    bool has_center = false, has_span = false;
+    long double cx = 0, cy = 0, span = 0;
+    for (const std::string& tok : tokens) {
+        size_t eq = tok.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value, got '" + tok + "'";
+            return false;
+        }
+        std::string key = tok.substr(0, eq), value = tok.substr(eq + 1);
+        bool ok = true;
+        if (key == "formula") {
+            if (value == "mandelbrot") job.formula = Formula::Mandelbrot;
+            else if (value == "burningship") job.formula = Formula::BurningShip;
+            else ok = false;
+        } else if (key == "view") {
+            ok = std::sscanf(value.c_str(), "%Lf,%Lf,%Lf,%Lf", &job.view.x_min, &job.view.x_max,
+                             &job.view.y_min, &job.view.y_max) == 4;
+        } else if (key == "center") {
+            ok = has_center = std::sscanf(value.c_str(), "%Lf,%Lf", &cx, &cy) == 2;
+        } else if (key == "span") {
+            ok = has_span = std::sscanf(value.c_str(), "%Lf", &span) == 1 && span > 0;
+        } else if (key == "size") {
+            ok = std::sscanf(value.c_str(), "%dx%d", &job.view.width, &job.view.height) == 2
+                 && job.view.width > 0 && job.view.height > 0;
+        } else if (key == "iter") {
+            ok = std::sscanf(value.c_str(), "%d", &job.max_iter) == 1 && job.max_iter > 0;
+        } else if (key == "palette") {
+            if (value == "red") job.palette = Palette::Red;
+            else if (value == "fire") job.palette = Palette::Fire;
+            else if (value == "gray") job.palette = Palette::Gray;
+            else ok = false;
+        } else if (key == "precision") {
+            job.auto_precision = value == "auto";
+            ok = job.auto_precision || parsePrecision(value, job.precision);
+        } else if (key == "out") {
+            job.output = value;
+        } else {
+            error = "unknown key '" + key + "'";
+            return false;
+        }
+        if (!ok) {
+            error = "bad value for " + key + ": '" + value + "'";
+            return false;
+        }
+    }
+    if (has_center != has_span) {
+        error = "center and span must be given together";
+        return false;
+    }
+    if (has_center) {
+        long double span_y = span * job.view.height / job.view.width;
+        job.view.x_min = cx - span / 2;
+        job.view.x_max = cx + span / 2;
+        job.view.y_min = cy - span_y / 2;
+        job.view.y_max = cy + span_y / 2;
+    }
+    if (job.output.empty()) {
+        error = "missing out=";
+        return false;
+    }
+    return true;
+}
+
+static bool readJobs(std::istream& in, std::vector<Job>& jobs) {
+    std::string line;
+    int line_no = 0;
+    bool ok = true;
+    while (std::getline(in, line)) {
+        ++line_no;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::vector<std::string> tokens;
+        for (std::string w; words >> w;) tokens.push_back(w);
+        if (tokens.empty()) continue;
+
+        Job job;
+        std::string error;
+        if (parseJob(tokens, job, error)) {
+            jobs.push_back(job);
+        } else {
+            std::cerr << "line " << line_no << ": " << error << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool runJob(const Job& job, RenderBuffers& buf) {
+    const Viewport& v = job.view;
+    const size_t count = (size_t)v.width * v.height;
+    buf.reserve(count);
+
+    Precision p = job.auto_precision ? selectPrecision(v, job.max_iter) : job.precision;
+    double* norms = job.palette == Palette::Red ? nullptr : buf.norms.data();
+    renderEscape(job.formula, p, v, job.max_iter, buf.iters.data(), norms);
+
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < (long long)count; ++i) {
+        int iter = buf.iters[i];
+        Color c;
+        if (job.palette == Palette::Red) {
+            c = redColor(iter, job.max_iter);
+        } else {
+            double smooth_iter = smoothTerm(iter, job.max_iter, buf.norms[i]);
+            c = job.palette == Palette::Fire ? getColor(iter, job.max_iter, smooth_iter)
+                                             : grayColor(iter, job.max_iter, smooth_iter);
+        }
+        buf.pixels[3 * i + 0] = (unsigned char)c.r;
+        buf.pixels[3 * i + 1] = (unsigned char)c.g;
+        buf.pixels[3 * i + 2] = (unsigned char)c.b;
+    }
+
+    std::ofstream img(job.output, std::ios::binary);
+    img << "P6\n" << v.width << " " << v.height << "\n255\n";
+    img.write((const char*)buf.pixels.data(), count * 3);
+    if (!img) {
+        std::cerr << job.output << ": write failed" << std::endl;
+        return false;
+    }
+    std::cout << job.output << ": " << v.width << "x" << v.height << ", Max iterations: "
+              << job.max_iter << ", Precision: " << precisionName(p);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: fractal_jobs <jobfile | - | key=value...>" << std::endl;
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+    std::string first = argv[1];
+    if (first.find('=') != std::string::npos) {
+        Job job;
+        std::string error;
+        if (!parseJob(std::vector<std::string>(argv + 1, argv + argc), job, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        jobs.push_back(job);
+    } else if (first == "-") {
+        if (!readJobs(std::cin, jobs)) return 1;
+    } else {
+        std::ifstream in(first);
+        if (!in) {
+            std::cerr << "Cannot open " << first << std::endl;
+            return 1;
+        }
+        if (!readJobs(in, jobs)) return 1;
+    }
+
+    RenderBuffers buffers;
+    int failed = 0;
+    double start = omp_get_wtime();
+    for (const Job& job : jobs) {
+        double t0 = omp_get_wtime();
+        if (runJob(job, buffers))
+            std::cout << " (" << omp_get_wtime() - t0 << " s)" << std::endl;
+        else
+            ++failed;
+    }
+    std::cout << jobs.size() - failed << "/" << jobs.size() << " jobs in "
+              << omp_get_wtime() - start << " s" << std::endl;
+    return failed ? 1 : 0;
+}
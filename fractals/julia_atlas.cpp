@@ -0,0 +1,175 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <omp.h>
+#include "fractal.h"
+
+// Renders a grid of Julia set thumbnails, one per c sampled over a region of
+// the Mandelbrot plane, into a single tiled image in one pass.
+//
+// The grid of c values is itself a small Mandelbrot viewport, so the shared
+// kernel renders it first. That reference tells us roughly how expensive each
+// Julia set will be; tiles are sorted by it and packed into SIMD lanes so the
+// lanes of one block (one c each, same pixel) finish at about the same time.
+//
+// Usage: julia_atlas [--cols N] [--rows N] [--tile PX] [--iter N]
+//                    [--view x_min,x_max,y_min,y_max] [--span S] [--out name]
+// Writes <name>.ppm and <name>.csv (tile index -> pixel origin, c, Mandelbrot
+// escape count at c).
+
+struct AtlasConfig {
+    int cols = 48, rows = 36, tile = 64, max_iter = 200;
+    Viewport c_grid = {-2.0L, 0.6L, -1.2L, 1.2L, 48, 36};
+    double span = 3.2;  // width and height of each thumbnail in the z plane
+    std::string out = "julia_atlas";
+};
+
+// Renders every tile in `order`, L tiles at a time. Each lane carries its own c
+// and all lanes walk the same pixel, so z0 is shared across the block.
+template<typename T>
+void renderAtlas(const AtlasConfig& cfg, const std::vector<int>& order,
+                 const std::vector<long double>& c_re, const std::vector<long double>& c_im,
+                 std::vector<Color>& image) {
+    constexpr int L = laneCount<T>();
+    const int tile = cfg.tile;
+    const int image_width = cfg.cols * tile;
+    const int blocks = ((int)order.size() + L - 1) / L;
+
+    std::vector<T> z0(tile);
+    for (int i = 0; i < tile; ++i)
+        z0[i] = T(-cfg.span / 2 + (i + 0.5) * cfg.span / tile);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int b = 0; b < blocks; ++b) {
+        int first = b * L;
+        int n = std::min(L, (int)order.size() - first);
+        T cr[L], ci[L];
+        for (int l = 0; l < L; ++l) {
+            // Pad the last block with its final tile so idle lanes stay in step.
+            int t = order[first + std::min(l, n - 1)];
+            cr[l] = T(c_re[t]);
+            ci[l] = T(c_im[t]);
+        }
+        for (int py = 0; py < tile; ++py) {
+            for (int px = 0; px < tile; ++px) {
+                T zx[L], zy[L];
+                int it[L];
+                for (int l = 0; l < L; ++l) {
+                    zx[l] = z0[px];
+                    zy[l] = -z0[py];  // image rows run top to bottom
+                }
+                escapeBlock<MandelbrotStep>(zx, zy, cr, ci, cfg.max_iter, T(4), it);
+                for (int l = 0; l < n; ++l) {
+                    int t = order[first + l];
+                    int x = (t % cfg.cols) * tile + px;
+                    int y = (t / cfg.cols) * tile + py;
+                    double norm = double(zx[l] * zx[l] + zy[l] * zy[l]);
+                    image[(size_t)y * image_width + x] =
+                        getColor(it[l], cfg.max_iter, smoothTerm(it[l], cfg.max_iter, norm));
+                }
+            }
+        }
+    }
+}
+
+static bool parseArgs(int argc, char* argv[], AtlasConfig& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        bool ok = true;
+        if (arg == "--cols") ok = std::sscanf(value, "%d", &cfg.cols) == 1 && cfg.cols > 0;
+        else if (arg == "--rows") ok = std::sscanf(value, "%d", &cfg.rows) == 1 && cfg.rows > 0;
+        else if (arg == "--tile") ok = std::sscanf(value, "%d", &cfg.tile) == 1 && cfg.tile > 0;
+        else if (arg == "--iter") ok = std::sscanf(value, "%d", &cfg.max_iter) == 1 && cfg.max_iter > 0;
+        else if (arg == "--span") ok = std::sscanf(value, "%lf", &cfg.span) == 1 && cfg.span > 0;
+        else if (arg == "--out") cfg.out = value;
+        else if (arg == "--view")
+            ok = std::sscanf(value, "%Lf,%Lf,%Lf,%Lf", &cfg.c_grid.x_min, &cfg.c_grid.x_max,
+                             &cfg.c_grid.y_min, &cfg.c_grid.y_max) == 4;
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+        if (!ok) {
+            std::cerr << "Bad value for " << arg << ": " << value << std::endl;
+            return false;
+        }
+    }
+    cfg.c_grid.width = cfg.cols;
+    cfg.c_grid.height = cfg.rows;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    AtlasConfig cfg;
+    if (!parseArgs(argc, argv, cfg)) return 1;
+
+    const int tiles = cfg.cols * cfg.rows;
+    const Viewport& g = cfg.c_grid;
+
+    // Mandelbrot reference over the c grid; c for tile (col, row) is exactly
+    // the pixel (col, row) of this viewport. Row 0 is the top of the atlas, so
+    // the grid is rendered upside down to keep imaginary parts increasing upwards.
+    Viewport flipped = {g.x_min, g.x_max, g.y_max, g.y_min, g.width, g.height};
+    std::vector<int> mandel_iter(tiles);
+    renderEscape<MandelbrotStep>(selectPrecision(g, cfg.max_iter), flipped, cfg.max_iter, 4.0,
+                                 mandel_iter.data());
+
+    std::vector<long double> c_re(tiles), c_im(tiles);
+    for (int t = 0; t < tiles; ++t) {
+        c_re[t] = flipped.x_min + (t % cfg.cols) * (flipped.x_max - flipped.x_min) / cfg.cols;
+        c_im[t] = flipped.y_min + (t / cfg.cols) * (flipped.y_max - flipped.y_min) / cfg.rows;
+    }
+
+    std::vector<int> order(tiles);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return mandel_iter[a] < mandel_iter[b]; });
+
+    const int image_width = cfg.cols * cfg.tile;
+    const int image_height = cfg.rows * cfg.tile;
+    std::vector<Color> image((size_t)image_width * image_height);
+
+    Viewport thumb = {-cfg.span / 2, cfg.span / 2, -cfg.span / 2, cfg.span / 2, cfg.tile, cfg.tile};
+    Precision p = selectPrecision(thumb, cfg.max_iter);
+    double t0 = omp_get_wtime();
+    switch (p) {
+        case Precision::Float: renderAtlas<float>(cfg, order, c_re, c_im, image); break;
+        case Precision::Double: renderAtlas<double>(cfg, order, c_re, c_im, image); break;
+        default: renderAtlas<long double>(cfg, order, c_re, c_im, image); break;
+    }
+    double seconds = omp_get_wtime() - t0;
+
+    std::vector<unsigned char> pixels(image.size() * 3);
+    for (size_t i = 0; i < image.size(); ++i) {
+        pixels[3 * i + 0] = (unsigned char)image[i].r;
+        pixels[3 * i + 1] = (unsigned char)image[i].g;
+        pixels[3 * i + 2] = (unsigned char)image[i].b;
+    }
+    std::ofstream img(cfg.out + ".ppm", std::ios::binary);
+    img << "P6\n" << image_width << " " << image_height << "\n255\n";
+    img.write((const char*)pixels.data(), pixels.size());
+
+    std::ofstream index(cfg.out + ".csv");
+    index.precision(17);
+    index << "tile,col,row,x,y,width,height,c_re,c_im,mandelbrot_iter\n";
+    for (int t = 0; t < tiles; ++t) {
+        int col = t % cfg.cols, row = t / cfg.cols;
+        index << t << "," << col << "," << row << "," << col * cfg.tile << "," << row * cfg.tile
+              << "," << cfg.tile << "," << cfg.tile << "," << (double)c_re[t] << ","
+              << (double)c_im[t] << "," << mandel_iter[t] << "\n";
+    }
+
+    std::cout << tiles << " Julia sets (" << image_width << "x" << image_height << ", "
+              << precisionName(p) << ") in " << seconds << " s, "
+              << tiles / seconds << " thumbnails/s" << std::endl;
+    return 0;
+}
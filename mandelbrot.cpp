@@ -1,36 +1,57 @@
 #include <iostream>
 #include <fstream>
-#include <complex>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <omp.h>
+#include "fractals/fractal.h"
 
-int main() {
+// Usage: mandelbrot [--precision auto|float|double|long] [--validate]
+int main(int argc, char* argv[]) {
     const int width = 800;
     const int height = 600;
     const int max_iter = 100;
 
+    const Viewport view = {-2.0L, 2.0L, -2.0L, 2.0L, width, height};
+
+    bool validate = false;
+    Precision precision = selectPrecision(view, max_iter);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--validate") {
+            validate = true;
+        } else if (arg == "--precision" && i + 1 < argc) {
+            std::string p = argv[++i];
+            if (p != "auto" && !parsePrecision(p, precision)) {
+                std::cerr << "Unknown precision: " << p << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::vector<int> iters((size_t)width * height);
+    renderEscape<MandelbrotStep>(precision, view, max_iter, 4.0, iters.data());
+    std::cout << "Precision: " << precisionName(precision) << std::endl;
+
+    if (validate) {
+        std::vector<int> reference((size_t)width * height);
+        renderEscape<MandelbrotStep>(Precision::Double, view, max_iter, 4.0, reference.data());
+        std::cout << "Pixels differing from double reference: "
+                  << 100.0 * mismatchRatio(iters, reference) << "%" << std::endl;
+    }
+
     std::ofstream img("mandelbrot.ppm");
     img << "P3\n" << width << " " << height << "\n255\n";
 
-    #pragma omp parallel for schedule(dynamic)
+    #pragma omp parallel for ordered schedule(static, 1)
     for (int y = 0; y < height; ++y) {
         std::stringstream row;
         for (int x = 0; x < width; ++x) {
-            std::complex<double> c(
-                (x - width / 2.0) * 4.0 / width,
-                (y - height / 2.0) * 4.0 / height
-            );
-            std::complex<double> z = 0;
-            int iter = 0;
-            while (abs(z) <= 2.0 && iter < max_iter) {
-                z = z * z + c;
-                iter++;
-            }
-
-            int color = 255 * iter / max_iter;
+            int color = 255 * iters[(size_t)y * width + x] / max_iter;
             row << color << " " << 0 << " " << 0 << "\n";
         }
 
-        #pragma omp critical
+        #pragma omp ordered
         img << row.str();
     }
 